@@ -0,0 +1,279 @@
+// base64.cpp
+#include "base64.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BASE64_SSSE3 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define BASE64_NEON 1
+#include <arm_neon.h>
+#endif
+
+static const char STANDARD_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char URL_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+static const unsigned char INVALID = 0xff;
+
+// Map every byte to its 6-bit value, INVALID when outside the alphabet
+struct DecodeTable
+{
+    unsigned char values[256];
+    explicit DecodeTable(const char *alphabet)
+    {
+        memset(values, INVALID, sizeof(values));
+        for (int i = 0; i < 64; i++)
+            values[static_cast<unsigned char>(alphabet[i])] = static_cast<unsigned char>(i);
+    }
+};
+
+static const DecodeTable STANDARD_DECODE(STANDARD_ALPHABET);
+static const DecodeTable URL_DECODE(URL_ALPHABET);
+
+/*
+  Vector kernels. Each processes whole blocks from the start of the input
+  and returns how much it consumed; the scalar code finishes the rest. The
+  decoders stop at the first block holding a character outside the
+  alphabet so the scalar code can report it.
+*/
+
+#ifdef BASE64_SSSE3
+
+// 12 input bytes -> 16 characters per step (16-byte loads, so 16 bytes must remain)
+__attribute__((target("ssse3"))) static size_t EncodeSSSE3(const unsigned char *in, size_t size, char *out, bool url)
+{
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    // Offset added to each 6-bit index, selected by its range
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          url ? '-' - 62 : '+' - 62, url ? '_' - 63 : '/' - 63, 'A', 0, 0);
+    size_t done = 0;
+    for (; size - done >= 16; done += 12, out += 16)
+    {
+        __m128i bytes = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done)), shuffle);
+
+        // Spread the 24 bits of each 3-byte group over four bytes
+        __m128i t0 = _mm_and_si128(bytes, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(bytes, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(t1, t3);
+
+        // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        __m128i chars = _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), chars);
+    }
+    return done;
+}
+
+// 16 characters -> 12 bytes per step
+__attribute__((target("ssse3"))) static size_t DecodeSSSE3(const char *in, size_t size, unsigned char *out, bool url)
+{
+    const __m128i c62 = _mm_set1_epi8(url ? '-' : '+');
+    const __m128i c63 = _mm_set1_epi8(url ? '_' : '/');
+    const __m128i shift62 = _mm_set1_epi8(static_cast<char>(62 - (url ? '-' : '+')));
+    const __m128i shift63 = _mm_set1_epi8(static_cast<char>(63 - (url ? '_' : '/')));
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t done = 0;
+    for (; size - done >= 16; done += 16, out += 12)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+
+        // Signed compares also reject bytes >= 0x80
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+        __m128i is62 = _mm_cmpeq_epi8(c, c62);
+        __m128i is63 = _mm_cmpeq_epi8(c, c63);
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(is62, is63)));
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            break;
+
+        __m128i shift = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-65)), _mm_and_si128(lower, _mm_set1_epi8(-71))),
+                                     _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(4)),
+                                                  _mm_or_si128(_mm_and_si128(is62, shift62), _mm_and_si128(is63, shift63))));
+        __m128i values = _mm_add_epi8(c, shift);
+
+        // Merge 6-bit values into 24-bit groups, then drop each group's top byte
+        __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+        unsigned char bytes[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes), _mm_shuffle_epi8(groups, pack));
+        memcpy(out, bytes, 12);
+    }
+    return done;
+}
+
+static bool HasSSSE3()
+{
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+}
+
+#endif // BASE64_SSSE3
+
+#ifdef BASE64_NEON
+
+static uint8x16x4_t LoadTable(const unsigned char *table)
+{
+    uint8x16x4_t t;
+    t.val[0] = vld1q_u8(table);
+    t.val[1] = vld1q_u8(table + 16);
+    t.val[2] = vld1q_u8(table + 32);
+    t.val[3] = vld1q_u8(table + 48);
+    return t;
+}
+
+// 48 input bytes -> 64 characters per step, deinterleaved by vld3/vst4
+static size_t EncodeNEON(const unsigned char *in, size_t size, char *out, bool url)
+{
+    const uint8x16x4_t alphabet = LoadTable(reinterpret_cast<const unsigned char *>(url ? URL_ALPHABET : STANDARD_ALPHABET));
+    size_t done = 0;
+    for (; size - done >= 48; done += 48, out += 64)
+    {
+        uint8x16x3_t bytes = vld3q_u8(in + done);
+        uint8x16x4_t chars;
+        chars.val[0] = vshrq_n_u8(bytes.val[0], 2);
+        chars.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(bytes.val[0], vdupq_n_u8(0x03)), 4), vshrq_n_u8(bytes.val[1], 4));
+        chars.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(bytes.val[1], vdupq_n_u8(0x0f)), 2), vshrq_n_u8(bytes.val[2], 6));
+        chars.val[3] = vandq_u8(bytes.val[2], vdupq_n_u8(0x3f));
+        for (int i = 0; i < 4; i++)
+            chars.val[i] = vqtbl4q_u8(alphabet, chars.val[i]);
+        vst4q_u8(reinterpret_cast<unsigned char *>(out), chars);
+    }
+    return done;
+}
+
+// 64 characters -> 48 bytes per step
+static size_t DecodeNEON(const char *in, size_t size, unsigned char *out, bool url)
+{
+    const unsigned char *table = (url ? URL_DECODE : STANDARD_DECODE).values;
+    const uint8x16x4_t low = LoadTable(table);
+    const uint8x16x4_t high = LoadTable(table + 64);
+    size_t done = 0;
+    for (; size - done >= 64; done += 64, out += 48)
+    {
+        uint8x16x4_t c = vld4q_u8(reinterpret_cast<const unsigned char *>(in + done));
+        uint8x16_t invalid = vdupq_n_u8(0);
+        for (int i = 0; i < 4; i++)
+        {
+            // Out-of-range lookups keep the INVALID default, so bytes >= 0x80 fail too
+            uint8x16_t v = vqtbx4q_u8(vdupq_n_u8(INVALID), low, c.val[i]);
+            v = vqtbx4q_u8(v, high, vsubq_u8(c.val[i], vdupq_n_u8(64)));
+            invalid = vorrq_u8(invalid, v);
+            c.val[i] = v;
+        }
+        if (vmaxvq_u8(invalid) > 63)
+            break;
+
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(c.val[0], 2), vshrq_n_u8(c.val[1], 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(c.val[1], 4), vshrq_n_u8(c.val[2], 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(c.val[2], 6), c.val[3]);
+        vst3q_u8(out, bytes);
+    }
+    return done;
+}
+
+#endif // BASE64_NEON
+
+static size_t EncodeKernel(const unsigned char *in, size_t size, char *out, bool url)
+{
+#if defined(BASE64_SSSE3)
+    if (HasSSSE3())
+        return EncodeSSSE3(in, size, out, url);
+#elif defined(BASE64_NEON)
+    return EncodeNEON(in, size, out, url);
+#endif
+    return 0;
+}
+
+static size_t DecodeKernel(const char *in, size_t size, unsigned char *out, bool url)
+{
+#if defined(BASE64_SSSE3)
+    if (HasSSSE3())
+        return DecodeSSSE3(in, size, out, url);
+#elif defined(BASE64_NEON)
+    return DecodeNEON(in, size, out, url);
+#endif
+    return 0;
+}
+
+const char *Base64Kernel()
+{
+#if defined(BASE64_SSSE3)
+    return HasSSSE3() ? "ssse3" : "scalar";
+#elif defined(BASE64_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+std::string Base64Encode(const unsigned char *data, size_t size, bool url)
+{
+    const char *alphabet = url ? URL_ALPHABET : STANDARD_ALPHABET;
+    size_t length = url ? (size * 4 + 2) / 3 : (size + 2) / 3 * 4;
+    std::string out(length, '=');
+
+    size_t i = EncodeKernel(data, size, &out[0], url);
+    size_t o = i / 3 * 4;
+    for (; i + 3 <= size; i += 3, o += 4)
+    {
+        uint32_t chunk = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out[o] = alphabet[chunk >> 18];
+        out[o + 1] = alphabet[(chunk >> 12) & 63];
+        out[o + 2] = alphabet[(chunk >> 6) & 63];
+        out[o + 3] = alphabet[chunk & 63];
+    }
+    if (i < size)
+    {
+        uint32_t chunk = data[i] << 16;
+        if (i + 1 < size)
+            chunk |= data[i + 1] << 8;
+        out[o] = alphabet[chunk >> 18];
+        out[o + 1] = alphabet[(chunk >> 12) & 63];
+        if (i + 1 < size)
+            out[o + 2] = alphabet[(chunk >> 6) & 63];
+    }
+    return out;
+}
+
+std::vector<unsigned char> Base64Decode(const std::string &text, bool url)
+{
+    const unsigned char *table = (url ? URL_DECODE : STANDARD_DECODE).values;
+    size_t length = text.size();
+    if (length % 4 == 0)
+    {
+        // Up to two padding characters end a padded input
+        for (int pad = 0; pad < 2 && length > 0 && text[length - 1] == '='; pad++)
+            length--;
+    }
+    if (length % 4 == 1)
+        throw std::runtime_error("Invalid base64 length");
+
+    std::vector<unsigned char> out(length / 4 * 3 + (length % 4 ? length % 4 - 1 : 0));
+    size_t i = DecodeKernel(text.data(), length, out.data(), url);
+    size_t o = i / 4 * 3;
+    uint32_t chunk = 0;
+    int bits = 0;
+    for (; i < length; i++)
+    {
+        unsigned char value = table[static_cast<unsigned char>(text[i])];
+        if (value == INVALID)
+            throw std::runtime_error("Invalid character in base64 data");
+        chunk = (chunk << 6) | value;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out[o++] = static_cast<unsigned char>(chunk >> bits);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,27 @@
+// base64.h
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Base64 codec (RFC 4648) with vectorized kernels: SSSE3 on x86 (picked at
+// run time), NEON on AArch64, and a scalar fallback for everything else and
+// for the tail of each input.
+
+// Encode bytes; the url alphabet uses '-' and '_' and omits the padding
+std::string Base64Encode(const unsigned char *data, size_t size, bool url = false);
+inline std::string Base64Encode(const std::vector<unsigned char> &data, bool url = false)
+{
+    return Base64Encode(data.data(), data.size(), url);
+}
+
+// Decode text in either padded or unpadded form; throws std::runtime_error on
+// characters outside the alphabet
+std::vector<unsigned char> Base64Decode(const std::string &text, bool url = false);
+
+// Name of the kernel in use: "ssse3", "neon" or "scalar"
+const char *Base64Kernel();
+
+#endif // BASE64_H
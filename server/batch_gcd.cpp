@@ -0,0 +1,146 @@
+// batch_gcd.cpp
+#include "batch_gcd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+// Run fn(i) for every i < count on up to `threads` threads, this one included
+template <typename Fn>
+static void ParallelFor(size_t count, unsigned threads, Fn fn)
+{
+    std::atomic<size_t> next{0};
+    auto work = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads && t < count; t++)
+        workers.emplace_back(work);
+    work();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+// Levels of the product tree over `leaves`, leaves first and the root last;
+// an odd node out is carried up unchanged
+static std::vector<std::vector<mpz_class>> ProductTree(std::vector<mpz_class> leaves, unsigned threads)
+{
+    std::vector<std::vector<mpz_class>> levels;
+    levels.push_back(std::move(leaves));
+    while (levels.back().size() > 1)
+    {
+        const std::vector<mpz_class> &below = levels.back();
+        std::vector<mpz_class> level((below.size() + 1) / 2);
+        ParallelFor(level.size(), threads, [&](size_t i)
+                    {
+            if (2 * i + 1 < below.size())
+                mpz_mul(level[i].get_mpz_t(), below[2 * i].get_mpz_t(), below[2 * i + 1].get_mpz_t());
+            else
+                level[i] = below[2 * i]; });
+        levels.push_back(std::move(level));
+    }
+    return levels;
+}
+
+// Push `remainder` (P mod root^2) down the tree: every node takes its
+// parent's remainder mod its own square. Returns the remainders at the leaves.
+static std::vector<mpz_class> RemainderTree(const std::vector<std::vector<mpz_class>> &levels, const mpz_class &remainder,
+                                            unsigned threads)
+{
+    std::vector<mpz_class> above(1, remainder);
+    for (size_t l = levels.size() - 1; l-- > 0;)
+    {
+        const std::vector<mpz_class> &nodes = levels[l];
+        std::vector<mpz_class> current(nodes.size());
+        ParallelFor(nodes.size(), threads, [&](size_t i)
+                    {
+            mpz_class square = nodes[i] * nodes[i];
+            mpz_mod(current[i].get_mpz_t(), above[i / 2].get_mpz_t(), square.get_mpz_t()); });
+        above = std::move(current);
+    }
+    return above;
+}
+
+std::vector<SharedFactor> BatchGcd(const std::vector<mpz_class> &moduli, const BatchGcdOptions &options)
+{
+    for (const mpz_class &n : moduli)
+    {
+        if (n < 2)
+            throw std::runtime_error("Moduli must be greater than 1");
+    }
+    if (moduli.size() < 2)
+        return {};
+
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    size_t groupSize = std::max<size_t>(2, options.groupSize);
+    size_t groups = (moduli.size() + groupSize - 1) / groupSize;
+    auto group_leaves = [&](size_t g)
+    {
+        return std::vector<mpz_class>(moduli.begin() + g * groupSize, moduli.begin() + std::min(moduli.size(), (g + 1) * groupSize));
+    };
+
+    // Group products, then the tree above them; a single group keeps its tree
+    std::vector<std::vector<mpz_class>> kept;
+    std::vector<mpz_class> roots(groups);
+    for (size_t g = 0; g < groups; g++)
+    {
+        std::vector<std::vector<mpz_class>> levels = ProductTree(group_leaves(g), threads);
+        roots[g] = levels.back()[0];
+        if (groups == 1)
+            kept = std::move(levels);
+    }
+    std::vector<mpz_class> rootRemainders;
+    {
+        std::vector<std::vector<mpz_class>> top = ProductTree(std::move(roots), threads);
+        rootRemainders = RemainderTree(top, top.back()[0], threads);
+    }
+
+    // P mod n^2 at every leaf gives the factors n shares with the others
+    std::vector<mpz_class> shared(moduli.size());
+    for (size_t g = 0; g < groups; g++)
+    {
+        std::vector<std::vector<mpz_class>> levels = groups == 1 ? std::move(kept) : ProductTree(group_leaves(g), threads);
+        std::vector<mpz_class> remainders = RemainderTree(levels, rootRemainders[g], threads);
+        levels.clear();
+        size_t first = g * groupSize;
+        ParallelFor(remainders.size(), threads, [&](size_t i)
+                    {
+            const mpz_class &n = moduli[first + i];
+            mpz_divexact(remainders[i].get_mpz_t(), remainders[i].get_mpz_t(), n.get_mpz_t());
+            mpz_gcd(shared[first + i].get_mpz_t(), remainders[i].get_mpz_t(), n.get_mpz_t()); });
+    }
+
+    std::vector<SharedFactor> found;
+    for (size_t i = 0; i < moduli.size(); i++)
+    {
+        if (shared[i] != 1)
+            found.push_back(SharedFactor{i, shared[i]});
+    }
+
+    // A modulus whose primes are both shared, with one key or several, comes
+    // out whole, as does a duplicate. Every partner it shares with is in
+    // `found`, so those few are split against each partner in turn; only a
+    // modulus all of whose partners are copies of it stays whole.
+    for (SharedFactor &entry : found)
+    {
+        const mpz_class &n = moduli[entry.index];
+        if (entry.factor != n)
+            continue;
+        for (const SharedFactor &other : found)
+        {
+            if (&other == &entry)
+                continue;
+            mpz_class g;
+            mpz_gcd(g.get_mpz_t(), n.get_mpz_t(), moduli[other.index].get_mpz_t());
+            if (g != 1 && g != n)
+            {
+                entry.factor = g;
+                break;
+            }
+        }
+    }
+    return found;
+}
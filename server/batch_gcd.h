@@ -0,0 +1,35 @@
+// batch_gcd.h
+#ifndef BATCH_GCD_H
+#define BATCH_GCD_H
+
+#include <gmpxx.h>
+#include <cstddef>
+#include <vector>
+
+// Bernstein's batch GCD: finds every modulus that shares a prime with another
+// modulus of the set in quasi-linear time instead of comparing all pairs.
+// A product tree gives P, the product of all moduli; a remainder tree reduces
+// P mod n_i^2 for every leaf, and gcd(n_i, (P mod n_i^2) / n_i) is the product
+// of the primes n_i shares with the other moduli.
+//
+// To bound memory the moduli are split into groups: only the tree above the
+// group products is kept whole, and each group's own tree is rebuilt while its
+// remainders are pushed down. Every level is spread over `threads` threads.
+
+// A modulus that shares a factor with another modulus of the set
+struct SharedFactor
+{
+    size_t index;     // position of the modulus in the input
+    mpz_class factor; // shared part of the modulus; the modulus itself for a duplicate
+};
+
+struct BatchGcdOptions
+{
+    unsigned threads = 0;    // 0 = one per core
+    size_t groupSize = 65536; // moduli per rebuilt subtree
+};
+
+// Moduli sharing a factor, in input order; empty when all are coprime
+std::vector<SharedFactor> BatchGcd(const std::vector<mpz_class> &moduli, const BatchGcdOptions &options = BatchGcdOptions());
+
+#endif // BATCH_GCD_H
@@ -0,0 +1,162 @@
+// binary_protocol.cpp
+#include "binary_protocol.h"
+#include "http_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+void put_be(std::string &out, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+uint64_t get_be(const unsigned char *data, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value = (value << 8) | data[i];
+    return value;
+}
+
+bool parse_binary_request(const std::string &frame, BinaryRequest &request)
+{
+    if (frame.size() < 4)
+        return false;
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(frame.data());
+    size_t key_length = get_be(data + 2, 2);
+    if (frame.size() < 4 + key_length)
+        return false;
+    request.opcode = data[0];
+    request.keyType = data[1];
+    request.key = frame.substr(4, key_length);
+    request.payload = frame.substr(4 + key_length);
+    return true;
+}
+
+std::string encode_binary_request(const BinaryRequest &request)
+{
+    std::string frame;
+    frame.reserve(4 + request.key.size() + request.payload.size());
+    frame.push_back(static_cast<char>(request.opcode));
+    frame.push_back(static_cast<char>(request.keyType));
+    put_be(frame, request.key.size(), 2);
+    frame += request.key;
+    frame += request.payload;
+    return frame;
+}
+
+// Read exactly size bytes
+static bool read_full(int fd, char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_frame(int fd, std::string &frame)
+{
+    unsigned char prefix[4];
+    if (!read_full(fd, reinterpret_cast<char *>(prefix), sizeof(prefix)))
+        return false;
+    size_t length = get_be(prefix, 4);
+    if (length > BINARY_MAX_FRAME)
+        return false;
+    frame.resize(length);
+    return length == 0 || read_full(fd, &frame[0], length);
+}
+
+bool write_frame(int fd, const std::string &frame)
+{
+    std::string prefix;
+    put_be(prefix, frame.size(), 4);
+    iovec iov[2] = {{&prefix[0], prefix.size()}, {const_cast<char *>(frame.data()), frame.size()}};
+    iovec *pending = iov;
+    size_t count = 2;
+    while (count > 0)
+    {
+        msghdr msg = {};
+        msg.msg_iov = pending;
+        msg.msg_iovlen = count;
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0)
+            return false;
+        count = advance_iovec(pending, count, sent);
+    }
+    return true;
+}
+
+// Serve frames on one connection until the client closes it
+static void handle_binary_client(int client_socket, std::string peer)
+{
+    std::string frame;
+    uint64_t served = 0;
+    while (read_frame(client_socket, frame))
+    {
+        BinaryRequest request;
+        BinaryResponse response;
+        if (!parse_binary_request(frame, request))
+        {
+            response.status = BIN_BAD_REQUEST;
+            response.payload = "Malformed frame";
+        }
+        else
+        {
+            response = process_binary_request(request);
+        }
+
+        std::string reply;
+        reply.reserve(1 + response.payload.size());
+        reply.push_back(static_cast<char>(response.status));
+        reply += response.payload;
+        if (!write_frame(client_socket, reply))
+            break;
+        served++;
+    }
+    close(client_socket);
+    std::cout << "[" << current_timestamp() << "] Binary connection " << peer << " closed after " << served << " frames\n";
+}
+
+void binary_accept_loop(int server_fd)
+{
+    while (true)
+    {
+        sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_socket = accept(server_fd, reinterpret_cast<sockaddr *>(&client_addr), &client_addr_len);
+        if (client_socket < 0)
+        {
+            perror("accept failed");
+            continue;
+        }
+
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
+        std::string peer = std::string(client_ip) + ":" + std::to_string(ntohs(client_addr.sin_port));
+        std::cout << "[" << current_timestamp() << "] New binary connection from " << peer << "\n";
+
+        // Binary connections are long-lived, so each gets its own thread
+        std::thread(handle_binary_client, client_socket, peer).detach();
+    }
+}
@@ -0,0 +1,88 @@
+// binary_protocol.h
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+  Length-prefixed binary protocol for internal high-volume callers. A
+  connection carries any number of request/response frames; all integers
+  are big-endian.
+
+      frame    := u32 length | length bytes
+      request  := u8 opcode | u8 key_type | u16 key_length | key | payload
+      response := u8 status | payload
+
+  key_type BIN_KEY_ID carries the 8-byte id of a stored key, BIN_KEY_DER a
+  PKCS#1 DER key. Payloads are raw bytes:
+
+      BIN_ENCRYPT   payload = plaintext,       response = ciphertext
+      BIN_DECRYPT   payload = ciphertext,      response = plaintext
+      BIN_SIGN      payload = message,         response = raw RSA signature
+      BIN_GENERATE  payload = u32 key bits,    response = u64 key id (0 when
+                    not stored) | u16 public DER length | public DER | private DER
+
+  An error response carries the message as its payload.
+*/
+
+// Largest frame accepted; the connection is closed on anything bigger
+const size_t BINARY_MAX_FRAME = 1 << 20;
+
+enum BinaryOpcode : uint8_t
+{
+    BIN_ENCRYPT = 1,
+    BIN_DECRYPT = 2,
+    BIN_GENERATE = 3,
+    BIN_SIGN = 4,
+};
+
+enum BinaryKeyType : uint8_t
+{
+    BIN_KEY_NONE = 0,
+    BIN_KEY_ID = 1,
+    BIN_KEY_DER = 2,
+};
+
+enum BinaryStatus : uint8_t
+{
+    BIN_OK = 0,
+    BIN_BAD_REQUEST = 1,
+    BIN_NOT_FOUND = 2,
+    BIN_ERROR = 3,
+};
+
+struct BinaryRequest
+{
+    uint8_t opcode = 0;
+    uint8_t keyType = BIN_KEY_NONE;
+    std::string key;
+    std::string payload;
+};
+
+struct BinaryResponse
+{
+    uint8_t status = BIN_OK;
+    std::string payload;
+};
+
+// Big-endian helpers shared by the server and its clients
+void put_be(std::string &out, uint64_t value, int bytes);
+uint64_t get_be(const unsigned char *data, int bytes);
+
+// Split a request frame into its fields; false when it is malformed
+bool parse_binary_request(const std::string &frame, BinaryRequest &request);
+std::string encode_binary_request(const BinaryRequest &request);
+
+// Blocking frame I/O; false on EOF, error or an oversized frame
+bool read_frame(int fd, std::string &frame);
+bool write_frame(int fd, const std::string &frame);
+
+// Run one request against rsa_lib and the key store (defined with the HTTP endpoints)
+BinaryResponse process_binary_request(const BinaryRequest &request);
+
+// Accept binary protocol connections on the listener, one thread each; does not return
+void binary_accept_loop(int server_fd);
+
+#endif // BINARY_PROTOCOL_H
@@ -0,0 +1,96 @@
+// buffer_pool.cpp
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Idle slabs kept by the request pool (4 MiB)
+static const size_t RECEIVE_POOL_IDLE_SLABS = 256;
+
+BufferPool::BufferPool(size_t maxIdle) : maxIdle(maxIdle)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for (char *slab : idle)
+        delete[] slab;
+}
+
+char *BufferPool::Acquire()
+{
+    inUse.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idle.empty())
+        {
+            char *slab = idle.back();
+            idle.pop_back();
+            return slab;
+        }
+    }
+    return new char[SLAB_SIZE];
+}
+
+void BufferPool::Release(char *slab)
+{
+    inUse.fetch_sub(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < maxIdle)
+        {
+            idle.push_back(slab);
+            return;
+        }
+    }
+    delete[] slab;
+}
+
+size_t BufferPool::Idle()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle.size();
+}
+
+BufferPool &receive_buffers()
+{
+    static BufferPool pool(RECEIVE_POOL_IDLE_SLABS);
+    return pool;
+}
+
+BufferChain::~BufferChain()
+{
+    for (char *slab : slabs)
+        pool.Release(slab);
+}
+
+char *BufferChain::WritableSpace(size_t &available)
+{
+    size_t used = size - (slabs.empty() ? 0 : (slabs.size() - 1) * BufferPool::SLAB_SIZE);
+    if (slabs.empty() || used == BufferPool::SLAB_SIZE)
+    {
+        slabs.push_back(pool.Acquire());
+        used = 0;
+    }
+    available = BufferPool::SLAB_SIZE - used;
+    return slabs.back() + used;
+}
+
+void BufferChain::Commit(size_t n)
+{
+    size += n;
+}
+
+void BufferChain::CopyTo(size_t offset, size_t length, std::string &out) const
+{
+    length = std::min(length, size > offset ? size - offset : 0);
+    while (length > 0)
+    {
+        size_t slab = offset / BufferPool::SLAB_SIZE;
+        size_t start = offset % BufferPool::SLAB_SIZE;
+        size_t n = std::min(length, BufferPool::SLAB_SIZE - start);
+        out.append(slabs[slab] + start, n);
+        offset += n;
+        length -= n;
+    }
+}
@@ -0,0 +1,76 @@
+// buffer_pool.h
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Pool of fixed-size receive slabs shared by all connections. Released slabs
+// are kept for reuse up to `maxIdle`, so steady traffic reads into warm
+// memory instead of allocating a buffer per request.
+class BufferPool
+{
+public:
+    static const size_t SLAB_SIZE = 16384;
+
+    explicit BufferPool(size_t maxIdle);
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // Take a slab of SLAB_SIZE bytes, reusing an idle one when possible
+    char *Acquire();
+    // Return a slab taken with Acquire
+    void Release(char *slab);
+
+    size_t Idle();
+    // Slabs currently handed out
+    uint64_t InUse() const { return inUse.load(std::memory_order_relaxed); }
+
+private:
+    size_t maxIdle;
+    std::mutex mutex;
+    std::vector<char *> idle;
+    std::atomic<uint64_t> inUse{0};
+};
+
+// Pool used for HTTP request reads
+BufferPool &receive_buffers();
+
+// Bytes received into a chain of pooled slabs. The chain grows a slab at a
+// time, so a large body is never copied to a bigger buffer while it
+// arrives; its slabs go back to the pool when the chain is destroyed.
+class BufferChain
+{
+public:
+    explicit BufferChain(BufferPool &pool) : pool(pool) {}
+    ~BufferChain();
+
+    BufferChain(const BufferChain &) = delete;
+    BufferChain &operator=(const BufferChain &) = delete;
+
+    // Free space at the end of the chain, adding a slab when the last one is full
+    char *WritableSpace(size_t &available);
+    // Account for `n` bytes written into the space returned by WritableSpace
+    void Commit(size_t n);
+
+    size_t Size() const { return size; }
+    // The first slab, which holds the request head
+    const char *Front() const { return slabs.empty() ? nullptr : slabs.front(); }
+    size_t FrontSize() const { return size < BufferPool::SLAB_SIZE ? size : BufferPool::SLAB_SIZE; }
+
+    // Append bytes [offset, offset + length) of the chain to `out`
+    void CopyTo(size_t offset, size_t length, std::string &out) const;
+
+private:
+    BufferPool &pool;
+    std::vector<char *> slabs;
+    size_t size = 0;
+};
+
+#endif // BUFFER_POOL_H
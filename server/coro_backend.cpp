@@ -0,0 +1,324 @@
+// coro_backend.cpp
+#include "coro_backend.h"
+#include "trace.h"
+
+#include <iostream>
+
+void DetachedTask::promise_type::unhandled_exception()
+{
+    try
+    {
+        throw;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "[" << current_timestamp() << "] Unhandled exception in connection coroutine: " << e.what() << "\n";
+    }
+    catch (...)
+    {
+        std::cerr << "[" << current_timestamp() << "] Unhandled exception in connection coroutine\n";
+    }
+}
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+IoContext::IoContext()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd < 0 || wakeFd < 0)
+    {
+        throw std::runtime_error(std::string("IoContext setup failed: ") + strerror(errno));
+    }
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // nullptr marks the wakeup descriptor
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+}
+
+IoContext::~IoContext()
+{
+    close(wakeFd);
+    close(epollFd);
+}
+
+IoContext::FdAwaiter IoContext::Readable(int fd)
+{
+    return FdAwaiter{*this, fd, EPOLLIN | EPOLLRDHUP};
+}
+
+IoContext::FdAwaiter IoContext::Writable(int fd)
+{
+    return FdAwaiter{*this, fd, EPOLLOUT};
+}
+
+// Arm a one-shot watch that resumes h when fd becomes ready
+void IoContext::Watch(int fd, uint32_t events, std::coroutine_handle<> h)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = h.address();
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) < 0 && errno == ENOENT)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void IoContext::Post(std::function<void()> fn)
+{
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(postedMutex);
+        wake = posted.empty();
+        posted.push_back(std::move(fn));
+    }
+    if (wake)
+    {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0)
+            std::cerr << "[" << current_timestamp() << "] eventfd write failed\n";
+    }
+}
+
+void IoContext::Run()
+{
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    while (true)
+    {
+        int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "[" << current_timestamp() << "] epoll_wait failed: " << strerror(errno) << "\n";
+            return;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr != nullptr)
+            {
+                std::coroutine_handle<>::from_address(events[i].data.ptr).resume();
+                continue;
+            }
+
+            uint64_t value;
+            while (read(wakeFd, &value, sizeof(value)) > 0)
+            {
+            }
+            std::vector<std::function<void()>> ready;
+            {
+                std::lock_guard<std::mutex> lock(postedMutex);
+                ready.swap(posted);
+            }
+            for (auto &fn : ready)
+                fn();
+        }
+    }
+}
+
+// Read one complete request from a non-blocking socket; false on EOF or error
+Task<bool> read_request(IoContext &io, int fd, HttpRequest &request)
+{
+    std::string raw;
+    char buffer[8192];
+    size_t body_offset = std::string::npos;
+    size_t content_length = 0;
+    while (true)
+    {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            co_await io.Readable(fd);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            co_return false;
+
+        raw.append(buffer, n);
+        if (body_offset == std::string::npos)
+        {
+            body_offset = parse_request_head(raw, request, content_length);
+            if (body_offset != std::string::npos && content_length <= max_body_size)
+                raw.reserve(body_offset + content_length);
+        }
+        if (!request_within_limits(request, raw.size(), body_offset, content_length))
+            co_return true;
+        if (body_offset != std::string::npos && raw.size() >= body_offset + content_length)
+        {
+            request.body = raw.substr(body_offset, content_length);
+            co_return true;
+        }
+    }
+}
+
+// Write the whole response to a non-blocking socket
+Task<bool> write_response(IoContext &io, int fd, HttpResponse &response)
+{
+    iovec storage[HTTP_RESPONSE_IOVECS];
+    iovec *iov = storage;
+    size_t count = response.ToIovec(iov);
+    while (count > 0)
+    {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            co_await io.Writable(fd);
+            continue;
+        }
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0)
+            co_return false;
+        count = advance_iovec(iov, count, sent);
+    }
+    co_return true;
+}
+
+// One connection: read, compute on the pool, write, close
+static DetachedTask serve_connection(IoContext &io, int fd, std::string peer, ShardMetrics &metrics)
+{
+    HttpRequest request;
+    request.peer = peer;
+    request.fd = fd;
+    // Stages on the I/O thread are timed by hand: a TraceScope must not
+    // outlive a suspension, since the thread then serves other connections
+    RequestTrace trace;
+    uint64_t stage = trace.StageStart();
+    if (co_await read_request(io, fd, request))
+    {
+        trace.StageEnd("read", stage);
+        trace.SetName(request.method + " " + request.path);
+        HttpResponse response = co_await offload(io, compute_pool(), [&request, &trace]()
+                                                 {
+            TraceScope scope(&trace);
+            TraceSpan span("process");
+            return process_request(request); });
+        if (response.IsDeferred())
+            response = co_await complete_deferred(io, response);
+        // Streamed bodies are produced while they are written, so the whole
+        // write runs on the pool instead of the I/O thread
+        bool sent;
+        stage = trace.StageStart();
+        if (response.IsStreaming())
+            sent = co_await offload(io, compute_pool(), [&response, &trace, fd]()
+                                    {
+                TraceScope scope(&trace);
+                return response.WriteTo(fd); });
+        else
+            sent = co_await write_response(io, fd, response);
+        trace.StageEnd("send", stage);
+        if (!sent)
+        {
+            std::cerr << "[" << current_timestamp() << "] Failed to send response to " << peer << "\n";
+        }
+    }
+    close(fd);
+    metrics.active--;
+    trace.Finish(peer);
+}
+
+// Accept on one shard listener and spread connections over the I/O contexts
+static DetachedTask accept_connections(IoContext &io, int server_fd, int shard, std::vector<std::unique_ptr<IoContext>> &contexts)
+{
+    size_t next = shard;
+    ShardMetrics &metrics = shard_metrics[shard];
+    while (true)
+    {
+        sockaddr_storage client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_socket = accept4(server_fd, reinterpret_cast<sockaddr *>(&client_addr), &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                co_await io.Readable(server_fd);
+            else if (errno != EINTR)
+                perror("accept failed");
+            continue;
+        }
+
+        std::string peer = describe_peer(client_addr);
+
+        metrics.accepted++;
+        metrics.active++;
+        IoContext &target = *contexts[next++ % contexts.size()];
+        if (&target == &io)
+        {
+            serve_connection(target, client_socket, peer, metrics);
+        }
+        else
+        {
+            target.Post([&target, client_socket, peer, &metrics]()
+                        { serve_connection(target, client_socket, peer, metrics); });
+        }
+    }
+}
+
+bool coro_supported()
+{
+    return true;
+}
+
+// Serve the shard listeners with io_threads I/O threads; does not return
+void coro_serve(const std::vector<int> &listeners, int io_threads)
+{
+    std::vector<std::unique_ptr<IoContext>> contexts;
+    for (int i = 0; i < io_threads; i++)
+        contexts.emplace_back(new IoContext());
+
+    for (size_t shard = 0; shard < listeners.size(); shard++)
+    {
+        int fd = listeners[shard];
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        IoContext &io = *contexts[shard % contexts.size()];
+        io.Post([&io, fd, shard, &contexts]()
+                { accept_connections(io, fd, shard, contexts); });
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < contexts.size(); i++)
+        threads.emplace_back(&IoContext::Run, contexts[i].get());
+    contexts[0]->Run();
+    for (std::thread &t : threads)
+        t.join();
+}
+
+#else // !__linux__
+
+#include <cstdlib>
+
+bool coro_supported()
+{
+    return false;
+}
+
+void coro_serve(const std::vector<int> &, int)
+{
+    std::cerr << "coroutine backend needs epoll and is not available on this platform\n";
+    std::abort();
+}
+
+#endif // __linux__
@@ -0,0 +1,213 @@
+// coro_backend.h
+#ifndef CORO_BACKEND_H
+#define CORO_BACKEND_H
+
+#include "http_server.h"
+#include "thread_pool.h"
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+  Coroutine I/O backend. Each connection is one coroutine:
+
+      HttpRequest request;
+      if (co_await read_request(io, fd, request))
+      {
+          HttpResponse response = co_await offload(io, compute_pool(), [&]() { return process_request(request); });
+          co_await write_response(io, fd, response);
+      }
+
+  Sockets are non-blocking; a coroutine that would block parks itself in its
+  IoContext (one epoll loop per I/O thread) and CPU-heavy work is awaited on
+  the compute pool, so a few I/O threads can multiplex many slow clients.
+*/
+
+// Lazily started coroutine returning T to the coroutine that awaits it
+template <typename T>
+class Task
+{
+public:
+    struct promise_type
+    {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // Resume the awaiting coroutine directly (symmetric transfer)
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                std::coroutine_handle<> next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T result) { value.emplace(std::move(result)); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume()
+    {
+        if (handle.promise().error)
+            std::rethrow_exception(handle.promise().error);
+        return std::move(*handle.promise().value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Fire-and-forget coroutine; its frame frees itself when it finishes
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception();
+    };
+};
+
+// One epoll loop; every coroutine it resumes runs on the thread calling Run()
+class IoContext
+{
+public:
+    IoContext();
+    ~IoContext();
+    IoContext(const IoContext &) = delete;
+    IoContext &operator=(const IoContext &) = delete;
+
+    // Loop forever, resuming coroutines whose descriptors are ready
+    void Run();
+
+    // Run fn on this context's thread; safe to call from any thread
+    void Post(std::function<void()> fn);
+
+    struct FdAwaiter
+    {
+        IoContext &io;
+        int fd;
+        uint32_t events;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { io.Watch(fd, events, h); }
+        void await_resume() const noexcept {}
+    };
+
+    FdAwaiter Readable(int fd);
+    FdAwaiter Writable(int fd);
+
+private:
+    void Watch(int fd, uint32_t events, std::coroutine_handle<> h);
+
+    int epollFd;
+    int wakeFd;
+    std::mutex postedMutex;
+    std::vector<std::function<void()>> posted;
+};
+
+// Run fn on the pool and resume the awaiting coroutine on io with its result
+template <typename Fn>
+auto offload(IoContext &io, ThreadPool &pool, Fn fn)
+{
+    using Result = std::invoke_result_t<Fn>;
+    struct Awaiter
+    {
+        IoContext &io;
+        ThreadPool &pool;
+        Fn fn;
+        std::optional<Result> result;
+        std::exception_ptr error;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            pool.Submit([this, h]()
+                        {
+                try
+                {
+                    result.emplace(fn());
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+                io.Post([h]() { h.resume(); }); });
+        }
+        Result await_resume()
+        {
+            if (error)
+                std::rethrow_exception(error);
+            return std::move(*result);
+        }
+    };
+    return Awaiter{io, pool, std::move(fn), std::nullopt, nullptr};
+}
+
+// Resume a deferred response and resume the awaiting coroutine on io with
+// the real response once it is delivered
+inline auto complete_deferred(IoContext &io, HttpResponse &deferred)
+{
+    struct Awaiter
+    {
+        IoContext &io;
+        HttpResponse &deferred;
+        std::optional<HttpResponse> result;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            deferred.Resume([this, h](HttpResponse response)
+                            {
+                result.emplace(std::move(response));
+                io.Post([h]() { h.resume(); }); });
+        }
+        HttpResponse await_resume() { return std::move(*result); }
+    };
+    return Awaiter{io, deferred, std::nullopt};
+}
+
+// Read one complete request from a non-blocking socket; false on EOF or error
+Task<bool> read_request(IoContext &io, int fd, HttpRequest &request);
+
+// Write the whole response to a non-blocking socket
+Task<bool> write_response(IoContext &io, int fd, HttpResponse &response);
+
+// Check whether the coroutine backend is available on this platform
+bool coro_supported();
+
+// Serve the shard listeners with io_threads I/O threads; does not return
+void coro_serve(const std::vector<int> &listeners, int io_threads);
+
+#endif // CORO_BACKEND_H
@@ -0,0 +1,287 @@
+// http_response.cpp
+#include "http_response.h"
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Static header blocks, formatted once
+static const char CORS_HEADERS[] = "Access-Control-Allow-Origin: *\r\n";
+static const char CORS_PREFLIGHT_HEADERS[] =
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
+    "Access-Control-Allow-Headers: Content-Type\r\n"
+    "Access-Control-Max-Age: 86400\r\n"; // 24 hours
+static const char CONNECTION_CLOSE[] = "Connection: close\r\n\r\n";
+
+static const char *StatusLine(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "HTTP/1.1 200 OK\r\n";
+    case 202:
+        return "HTTP/1.1 202 Accepted\r\n";
+    case 204:
+        return "HTTP/1.1 204 No Content\r\n";
+    case 400:
+        return "HTTP/1.1 400 Bad Request\r\n";
+    case 404:
+        return "HTTP/1.1 404 Not Found\r\n";
+    case 413:
+        return "HTTP/1.1 413 Payload Too Large\r\n";
+    case 431:
+        return "HTTP/1.1 431 Request Header Fields Too Large\r\n";
+    case 503:
+        return "HTTP/1.1 503 Service Unavailable\r\n";
+    default:
+        return "HTTP/1.1 500 Internal Server Error\r\n";
+    }
+}
+
+// How long a blocked write may wait for the client to drain its socket
+static const int SEND_STALL_TIMEOUT_MS = 30000;
+
+// Header buffers are recycled per thread so their capacity is reused
+static const size_t HEADER_POOL_SIZE = 64;
+static thread_local std::vector<std::string> header_pool;
+
+static std::string AcquireHeaderBuffer()
+{
+    if (header_pool.empty())
+    {
+        std::string buffer;
+        buffer.reserve(256);
+        return buffer;
+    }
+    std::string buffer = std::move(header_pool.back());
+    header_pool.pop_back();
+    buffer.clear();
+    return buffer;
+}
+
+static void ReleaseHeaderBuffer(std::string &buffer)
+{
+    if (buffer.capacity() > 0 && header_pool.size() < HEADER_POOL_SIZE)
+    {
+        header_pool.push_back(std::move(buffer));
+    }
+}
+
+HttpResponse::HttpResponse(int status) : status(status), headers(AcquireHeaderBuffer())
+{
+}
+
+HttpResponse::~HttpResponse()
+{
+    ReleaseHeaderBuffer(headers);
+}
+
+HttpResponse::HttpResponse(HttpResponse &&other) noexcept
+    : status(other.status), preflight(other.preflight), sealed(other.sealed),
+      headers(std::move(other.headers)), body(std::move(other.body)), producer(std::move(other.producer)),
+      start(std::move(other.start))
+{
+}
+
+HttpResponse &HttpResponse::operator=(HttpResponse &&other) noexcept
+{
+    if (this != &other)
+    {
+        ReleaseHeaderBuffer(headers);
+        status = other.status;
+        preflight = other.preflight;
+        sealed = other.sealed;
+        headers = std::move(other.headers);
+        body = std::move(other.body);
+        producer = std::move(other.producer);
+        start = std::move(other.start);
+    }
+    return *this;
+}
+
+HttpResponse HttpResponse::Preflight()
+{
+    HttpResponse response(204);
+    response.preflight = true;
+    return response;
+}
+
+HttpResponse HttpResponse::Content(const std::string &contentType, std::string body)
+{
+    HttpResponse response(200);
+    response.SetContent(contentType, std::move(body));
+    return response;
+}
+
+HttpResponse HttpResponse::Stream(const std::string &contentType, std::function<void(ChunkWriter &)> producer)
+{
+    HttpResponse response(200);
+    response.headers.append("Content-Type: ").append(contentType).append("\r\n");
+    response.producer = std::move(producer);
+    return response;
+}
+
+HttpResponse HttpResponse::Deferred(std::function<void(Completion)> start)
+{
+    HttpResponse response;
+    response.start = std::move(start);
+    return response;
+}
+
+void HttpResponse::Resume(Completion done)
+{
+    std::function<void(Completion)> starting = std::move(start);
+    start = nullptr;
+    starting(std::move(done));
+}
+
+void HttpResponse::SetContent(const std::string &contentType, std::string content)
+{
+    headers.append("Content-Type: ").append(contentType).append("\r\n");
+    body = std::move(content);
+}
+
+void HttpResponse::AddHeader(const char *name, const std::string &value)
+{
+    headers.append(name).append(": ").append(value).append("\r\n");
+}
+
+// Append Content-Length once the body is final
+void HttpResponse::Seal()
+{
+    if (sealed)
+        return;
+    sealed = true;
+    if (preflight)
+        return;
+    if (producer)
+    {
+        headers.append("Transfer-Encoding: chunked\r\n");
+        return;
+    }
+    char length[32];
+    int n = snprintf(length, sizeof(length), "Content-Length: %zu\r\n", body.size());
+    headers.append(length, n);
+}
+
+// Fill iov (HTTP_RESPONSE_IOVECS entries) and return how many are used
+size_t HttpResponse::ToIovec(iovec *iov)
+{
+    Seal();
+    const char *status_line = StatusLine(status);
+    const char *cors = preflight ? CORS_PREFLIGHT_HEADERS : CORS_HEADERS;
+    size_t count = 0;
+    iov[count++] = {const_cast<char *>(status_line), strlen(status_line)};
+    iov[count++] = {const_cast<char *>(cors), strlen(cors)};
+    if (!headers.empty())
+        iov[count++] = {&headers[0], headers.size()};
+    iov[count++] = {const_cast<char *>(CONNECTION_CLOSE), sizeof(CONNECTION_CLOSE) - 1};
+    if (!body.empty())
+        iov[count++] = {&body[0], body.size()};
+    return count;
+}
+
+size_t HttpResponse::Size()
+{
+    iovec iov[HTTP_RESPONSE_IOVECS];
+    size_t count = ToIovec(iov);
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++)
+        size += iov[i].iov_len;
+    return size;
+}
+
+// Write the whole response to a socket, retrying partial writes
+bool HttpResponse::WriteTo(int fd)
+{
+    iovec iov[HTTP_RESPONSE_IOVECS];
+    size_t count = ToIovec(iov);
+    if (!send_iovec(fd, iov, count))
+        return false;
+    if (!producer)
+        return true;
+
+    ChunkWriter writer(fd);
+    producer(writer);
+    return writer.Finish();
+}
+
+bool ChunkWriter::Write(const std::string &data)
+{
+    if (failed)
+        return false;
+    if (data.empty())
+        return true; // a zero-length chunk would end the body
+    char size[24];
+    int n = snprintf(size, sizeof(size), "%zx\r\n", data.size());
+    iovec iov[3] = {{size, static_cast<size_t>(n)},
+                    {const_cast<char *>(data.data()), data.size()},
+                    {const_cast<char *>("\r\n"), 2}};
+    failed = !send_iovec(fd, iov, 3);
+    return !failed;
+}
+
+bool ChunkWriter::Finish()
+{
+    if (failed)
+        return false;
+    iovec iov = {const_cast<char *>("0\r\n\r\n"), 5};
+    failed = !send_iovec(fd, &iov, 1);
+    return !failed;
+}
+
+// Advance an iovec array past bytes already written; returns entries left
+size_t advance_iovec(iovec *&iov, size_t count, size_t written)
+{
+    while (count > 0 && written >= iov->iov_len)
+    {
+        written -= iov->iov_len;
+        iov++;
+        count--;
+    }
+    if (count > 0)
+    {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+        iov->iov_len -= written;
+    }
+    return count;
+}
+
+// Send a whole iovec array, waiting for writability on non-blocking sockets
+bool send_iovec(int fd, iovec *iov, size_t count)
+{
+    while (count > 0)
+    {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // Give up on a client that stops reading rather than pin the thread
+                pollfd p = {fd, POLLOUT, 0};
+                int ready = poll(&p, 1, SEND_STALL_TIMEOUT_MS);
+                if (ready == 0 || (ready < 0 && errno != EINTR))
+                    return false;
+                continue;
+            }
+            return false;
+        }
+        count = advance_iovec(iov, count, sent);
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+// http_response.h
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// Maximum number of iovecs a response is split into
+const size_t HTTP_RESPONSE_IOVECS = 5;
+
+// Writes the body of a streamed response as HTTP/1.1 chunks straight to the
+// client socket. Write blocks until the chunk is sent (polling non-blocking
+// sockets) and returns false once the client is gone, so producers can stop.
+class ChunkWriter
+{
+public:
+    explicit ChunkWriter(int fd) : fd(fd) {}
+    bool Write(const std::string &data);
+    // Send the terminating zero-length chunk
+    bool Finish();
+
+private:
+    int fd;
+    bool failed = false;
+};
+
+// An HTTP response kept as separate pieces so it can be written with one
+// writev/sendmsg: the status line and CORS block are preformatted constants,
+// the dynamic headers live in a pooled buffer and the body is moved in
+// without copying.
+class HttpResponse
+{
+public:
+    explicit HttpResponse(int status = 200);
+    ~HttpResponse();
+
+    HttpResponse(HttpResponse &&other) noexcept;
+    HttpResponse &operator=(HttpResponse &&other) noexcept;
+    HttpResponse(const HttpResponse &) = delete;
+    HttpResponse &operator=(const HttpResponse &) = delete;
+
+    // Preflight (OPTIONS) answer: 204 with the full CORS header block
+    static HttpResponse Preflight();
+    // 200 response carrying content of the given media type
+    static HttpResponse Content(const std::string &contentType, std::string body);
+    static HttpResponse Json(std::string body) { return Content("application/json", std::move(body)); }
+    // 200 response whose body is produced while it is sent, with chunked
+    // transfer encoding; producer runs on the thread calling WriteTo
+    static HttpResponse Stream(const std::string &contentType, std::function<void(ChunkWriter &)> producer);
+
+    // Delivers the real response of a deferred one; callable from any thread, once
+    using Completion = std::function<void(HttpResponse)>;
+    // Placeholder for a response that is not ready yet, e.g. a long-poll:
+    // the backend calls Resume with a Completion instead of sending it, so no
+    // worker thread is held while the response waits
+    static HttpResponse Deferred(std::function<void(Completion)> start);
+
+    int Status() const { return status; }
+    const std::string &Body() const { return body; }
+    bool IsStreaming() const { return static_cast<bool>(producer); }
+    bool IsDeferred() const { return static_cast<bool>(start); }
+    // Start a deferred response; `done` may run before Resume returns
+    void Resume(Completion done);
+
+    // Set the body (once); Content-Length is added when the response is sealed
+    void SetContent(const std::string &contentType, std::string content);
+    void AddHeader(const char *name, const std::string &value);
+
+    // Fill iov (HTTP_RESPONSE_IOVECS entries) and return how many are used;
+    // for a streamed response this is only the header block
+    size_t ToIovec(iovec *iov);
+    size_t Size();
+
+    // Write the whole response to a socket, retrying partial writes; a
+    // streamed response runs its producer here, so call it off the I/O thread
+    bool WriteTo(int fd);
+
+private:
+    void Seal();
+
+    int status;
+    bool preflight = false;
+    bool sealed = false;
+    std::string headers; // pooled buffer for the dynamic header lines
+    std::string body;
+    std::function<void(ChunkWriter &)> producer;
+    std::function<void(Completion)> start;
+};
+
+// Advance an iovec array past bytes already written; returns entries left
+size_t advance_iovec(iovec *&iov, size_t count, size_t written);
+
+// Send a whole iovec array, waiting for writability on non-blocking sockets
+bool send_iovec(int fd, iovec *iov, size_t count);
+
+#endif // HTTP_RESPONSE_H
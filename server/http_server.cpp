@@ -1,10 +1,28 @@
 // http_server.cpp
 #include "rsa_lib.h"
+#include "key_store.h"
+#include "http_server.h"
+#include "http_response.h"
+#include "uring_backend.h"
+#include "coro_backend.h"
+#include "keygen_jobs.h"
+#include "binary_protocol.h"
+#include "shm_transport.h"
+#include "base64.h"
+#include "buffer_pool.h"
+#include "trace.h"
+#include "probes.h"
+#include "prime_cache.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <cctype>
+#include <cerrno>
 #include <cstring>
 #include <string>
 #include <thread>
@@ -14,14 +32,36 @@
 #include <iomanip>
 #include <vector>
 #include <ctime>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <pthread.h>
+
+// Function to get the pool running endpoint work for the event-driven backends
+ThreadPool &compute_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
 
-// Function to get the current timestamp for logging
-std::string current_timestamp()
+// Function to describe an accepted peer for logging ("ip:port" or "unix")
+std::string describe_peer(const sockaddr_storage &addr)
 {
-    std::time_t now = std::time(nullptr);
-    char buf[100];
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
-    return std::string(buf);
+    if (addr.ss_family == AF_INET)
+    {
+        const sockaddr_in &in = reinterpret_cast<const sockaddr_in &>(addr);
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &in.sin_addr, client_ip, INET_ADDRSTRLEN);
+        return std::string(client_ip) + ":" + std::to_string(ntohs(in.sin_port));
+    }
+    if (addr.ss_family == AF_UNIX)
+        return "unix";
+    return "unknown";
 }
 
 // Function to URL-decode a string
@@ -84,479 +124,1586 @@ std::map<std::string, std::string> parse_headers(const std::string &headers)
     return header_map;
 }
 
-// Function to add CORS headers to a response
-std::string add_cors_headers(const std::string &response) {
-    std::istringstream iss(response);
-    std::string status_line;
-    std::getline(iss, status_line);
-    
-    // Prepare CORS headers
-    std::ostringstream oss;
-    oss << status_line << "\r\n"
-        << "Access-Control-Allow-Origin: *\r\n"
-        << "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
-        << "Access-Control-Allow-Headers: Content-Type\r\n"
-        << "Access-Control-Max-Age: 86400\r\n" // 24 hours
-        << response.substr(status_line.length() + 2); // +2 for CRLF
-    return oss.str();
+// Function to send a complete HTTP response with a single sendmsg per attempt
+bool send_response(int client_socket, HttpResponse &response)
+{
+    if (!response.WriteTo(client_socket))
+    {
+        std::cerr << "[" << current_timestamp() << "] Error sending response.\n";
+        return false;
+    }
+    return true;
 }
 
-// Function to send a complete HTTP response
-bool send_response(int client_socket, const std::string &response)
+// Function to get a header's media type (value without parameters)
+std::string media_type(const std::map<std::string, std::string> &header_map, const std::string &name)
 {
-    size_t total_sent = 0;
-    size_t to_send = response.length();
-    const char *data = response.c_str();
+    auto it = header_map.find(name);
+    if (it == header_map.end())
+        return "";
+    std::string value = it->second.substr(0, it->second.find(';'));
+    value.erase(value.find_last_not_of(" \t") + 1);
+    return value;
+}
 
-    while (total_sent < to_send)
+// Function to undo JSON string escapes (PEM keys arrive with "\n" escapes)
+std::string json_unescape(const std::string &value)
+{
+    std::string ret;
+    ret.reserve(value.length());
+    for (size_t i = 0; i < value.length(); i++)
     {
-        ssize_t sent = send(client_socket, data + total_sent, to_send - total_sent, 0);
-        if (sent == -1)
+        if (value[i] != '\\' || i + 1 == value.length())
         {
-            std::cerr << "[" << current_timestamp() << "] Error sending response.\n";
-            return false;
+            ret += value[i];
+            continue;
         }
-        total_sent += sent;
+        char next = value[++i];
+        if (next == 'n')
+            ret += '\n';
+        else if (next == 'r')
+            ret += '\r';
+        else if (next == 't')
+            ret += '\t';
+        else
+            ret += next;
     }
-    return true;
+    return ret;
 }
 
-// Function to handle a single client connection
-void handle_client(int client_socket, sockaddr_in client_addr)
+// Function to escape a string for embedding in a JSON string literal
+std::string json_escape(const std::string &value)
 {
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
-    int client_port = ntohs(client_addr.sin_port);
+    std::string ret;
+    ret.reserve(value.length());
+    for (char ch : value)
+    {
+        if (ch == '\n')
+            ret += "\\n";
+        else if (ch == '"' || ch == '\\')
+            ret += std::string("\\") + ch;
+        else
+            ret += ch;
+    }
+    return ret;
+}
 
-    std::cout << "[" << current_timestamp() << "] New connection from " << client_ip << ":" << client_port << "\n";
+// Function to extract a string field from a flat JSON object
+std::string json_string_field(const std::string &body, const std::string &name)
+{
+    size_t pos = body.find("\"" + name + "\"");
+    if (pos == std::string::npos)
+        return "";
+    size_t colon = body.find(':', pos);
+    size_t quote1 = body.find('\"', colon);
+    size_t quote2 = body.find('\"', quote1 + 1);
+    if (colon == std::string::npos || quote1 == std::string::npos || quote2 == std::string::npos)
+        return "";
+    return body.substr(quote1 + 1, quote2 - quote1 - 1);
+}
 
-    const int buffer_size = 8192; // Increased buffer size for larger requests
-    char buffer[buffer_size];
-    memset(buffer, 0, buffer_size);
+// Function to read an unsigned integer field of a flat JSON object; false when missing or invalid
+bool json_uint_field(const std::string &body, const std::string &name, uint64_t &value)
+{
+    size_t pos = body.find("\"" + name + "\"");
+    if (pos == std::string::npos)
+        return false;
+    size_t colon = body.find(':', pos);
+    if (colon == std::string::npos)
+        return false;
+    size_t start = body.find_first_not_of(" \t\r\n", colon + 1);
+    if (start == std::string::npos || !isdigit(static_cast<unsigned char>(body[start])))
+        return false;
+    errno = 0;
+    char *end;
+    value = strtoull(body.c_str() + start, &end, 10);
+    return errno == 0;
+}
 
-    // Read the request
-    ssize_t bytes_received = recv(client_socket, buffer, buffer_size - 1, 0);
-    if (bytes_received < 0)
+// Function to extract an array of strings from a flat JSON object
+std::vector<std::string> json_string_array(const std::string &body, const std::string &name)
+{
+    std::vector<std::string> values;
+    size_t pos = body.find("\"" + name + "\"");
+    if (pos == std::string::npos)
+        return values;
+    size_t open = body.find('[', pos);
+    if (open == std::string::npos)
+        return values;
+    for (size_t i = open + 1; i < body.size() && body[i] != ']'; i++)
     {
-        std::cerr << "[" << current_timestamp() << "] Error receiving data from " << client_ip << ":" << client_port << "\n";
-        close(client_socket);
-        return;
+        if (body[i] != '\"')
+            continue;
+        // Find the closing quote, skipping escaped characters
+        size_t end = i + 1;
+        while (end < body.size() && body[end] != '\"')
+            end += body[end] == '\\' ? 2 : 1;
+        if (end >= body.size())
+            break;
+        values.push_back(json_unescape(body.substr(i + 1, end - i - 1)));
+        i = end;
     }
-    else if (bytes_received == 0)
+    return values;
+}
+
+// Function to hex-encode bytes
+std::string hex_encode(const std::vector<unsigned char> &bytes)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(bytes.size() * 2, '0');
+    for (size_t i = 0; i < bytes.size(); i++)
     {
-        std::cout << "[" << current_timestamp() << "] Connection closed by client " << client_ip << ":" << client_port << "\n";
-        close(client_socket);
-        return;
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0f];
     }
+    return hex;
+}
 
-    std::string request(buffer, bytes_received);
-    std::cout << "[" << current_timestamp() << "] Received request from " << client_ip << ":" << client_port << "\n";
-    std::cout << request << "\n";
+// Function to decode a hex string to bytes
+std::vector<unsigned char> hex_decode(const std::string &hex)
+{
+    if (hex.length() % 2 != 0)
+        throw std::runtime_error("Invalid encrypted_text length");
+    std::vector<unsigned char> bytes;
+    bytes.reserve(hex.length() / 2);
+    for (size_t i = 0; i < hex.length(); i += 2)
+    {
+        std::string byte_str = hex.substr(i, 2);
+        bytes.push_back(static_cast<unsigned char>(strtol(byte_str.c_str(), nullptr, 16)));
+    }
+    return bytes;
+}
 
-    std::istringstream request_stream(request);
-    std::string request_line;
-    std::getline(request_stream, request_line);
+// Text encoding of binary values (ciphertexts and keys) in JSON requests and
+// responses, chosen with the "encoding" field. Hex keys use the "n-e" / "n-d"
+// form; base64 keys are the base64 of their PKCS#1 DER.
+enum class Encoding
+{
+    Hex,
+    Base64,
+    Base64Url
+};
 
-    // Parse the request line
-    std::istringstream request_line_stream(request_line);
-    std::string method;
-    std::string path;
-    std::string http_version;
-    request_line_stream >> method >> path >> http_version;
+// Function to parse an encoding name; false if unknown
+bool parse_encoding_name(const std::string &name, Encoding &encoding)
+{
+    if (name.empty() || name == "hex")
+        encoding = Encoding::Hex;
+    else if (name == "base64")
+        encoding = Encoding::Base64;
+    else if (name == "base64url")
+        encoding = Encoding::Base64Url;
+    else
+        return false;
+    return true;
+}
 
-    // Handle preflight OPTIONS request
-    if (method == "OPTIONS") {
-        std::cout << "[" << current_timestamp() << "] Handling OPTIONS request from " << client_ip << ":" << client_port << "\n";
-        std::ostringstream oss;
-        oss << "HTTP/1.1 204 No Content\r\n"
-            << "Access-Control-Allow-Origin: *\r\n"
-            << "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
-            << "Access-Control-Allow-Headers: Content-Type\r\n"
-            << "Access-Control-Max-Age: 86400\r\n" // 24 hours
-            << "Connection: close\r\n"
-            << "\r\n";
-        send_response(client_socket, oss.str());
-        close(client_socket);
-        return;
+// Function to read the "encoding" field of a JSON request body (hex by default); false if unknown
+bool parse_encoding(const std::string &body, Encoding &encoding)
+{
+    return parse_encoding_name(json_string_field(body, "encoding"), encoding);
+}
+
+// Function to encode bytes in the requested encoding
+std::string encode_bytes(const std::vector<unsigned char> &bytes, Encoding encoding)
+{
+    if (encoding == Encoding::Hex)
+        return hex_encode(bytes);
+    return Base64Encode(bytes, encoding == Encoding::Base64Url);
+}
+
+// Function to decode bytes given in the requested encoding
+std::vector<unsigned char> decode_bytes(const std::string &text, Encoding encoding)
+{
+    if (encoding == Encoding::Hex)
+        return hex_decode(text);
+    return Base64Decode(text, encoding == Encoding::Base64Url);
+}
+
+// Optional persistent key store, enabled with --key-store PATH
+std::unique_ptr<KeyStore> key_store;
+
+// Thrown when a request references a key id that is not in the key store
+struct KeyNotFound : std::runtime_error
+{
+    explicit KeyNotFound(const std::string &key_id) : std::runtime_error("Unknown key_id: " + key_id) {}
+};
+
+// Function to load a public key from the key store
+PublicKey find_public_key(const std::string &key_id)
+{
+    PublicKey pub;
+    if (!key_store || !key_store->Find(KeyStore::IdFromString(key_id), &pub, nullptr))
+        throw KeyNotFound(key_id);
+    return pub;
+}
+
+// Function to parse a public key given as PEM, hexa ("n-e") or base64 DER
+PublicKey parse_public_key(const std::string &public_key, Encoding encoding = Encoding::Hex)
+{
+    std::string key = json_unescape(public_key);
+    if (key.compare(0, 10, "-----BEGIN") == 0)
+        return PublicKey::FromPEM(key);
+    if (encoding != Encoding::Hex)
+    {
+        std::vector<unsigned char> der = decode_bytes(key, encoding);
+        return PublicKey::FromDER(der.data(), der.size());
     }
+    return PublicKey::FromHexa(key);
+}
 
-    // Parse headers
-    std::string headers;
-    std::string header_line;
-    while (std::getline(request_stream, header_line) && header_line != "\r")
+// Parsed private keys, kept so repeated /decrypt calls with the same key
+// reuse its cached blinding pair instead of regenerating one per request
+const size_t PRIVATE_KEY_CACHE_SIZE = 256;
+std::mutex private_key_cache_mutex;
+std::map<std::string, std::shared_ptr<const PrivateKey>> private_key_cache;
+
+// Function to load a private key from the key store, using the cache when possible
+std::shared_ptr<const PrivateKey> find_private_key(const std::string &key_id)
+{
+    std::string cache_key = "id:" + key_id;
     {
-        headers += header_line + "\n";
+        std::lock_guard<std::mutex> lock(private_key_cache_mutex);
+        auto it = private_key_cache.find(cache_key);
+        if (it != private_key_cache.end())
+            return it->second;
     }
-    auto header_map = parse_headers(headers);
 
-    // Determine content length
-    int content_length = 0;
-    if (header_map.find("Content-Length") != header_map.end())
+    auto priv = std::make_shared<PrivateKey>();
+    if (!key_store || !key_store->Find(KeyStore::IdFromString(key_id), nullptr, priv.get()))
+        throw KeyNotFound(key_id);
+
+    std::lock_guard<std::mutex> lock(private_key_cache_mutex);
+    if (private_key_cache.size() >= PRIVATE_KEY_CACHE_SIZE)
+        private_key_cache.clear();
+    private_key_cache[cache_key] = priv;
+    return priv;
+}
+
+// Function to parse a private key (PEM, hexa "n-d" or raw DER), using the cache when possible
+std::shared_ptr<const PrivateKey> get_private_key(const std::string &private_key, bool der = false)
+{
+    std::string cache_key = (der ? "der:" : "txt:") + private_key;
     {
-        try
-        {
-            content_length = std::stoi(header_map["Content-Length"]);
-        }
-        catch (...)
-        {
-            std::cerr << "[" << current_timestamp() << "] Invalid Content-Length from " << client_ip << ":" << client_port << "\n";
-        }
+        std::lock_guard<std::mutex> lock(private_key_cache_mutex);
+        auto it = private_key_cache.find(cache_key);
+        if (it != private_key_cache.end())
+            return it->second;
     }
 
-    // Read the body
-    std::string body;
-    if (content_length > 0)
+    std::shared_ptr<PrivateKey> priv;
+    if (der)
+    {
+        priv = std::make_shared<PrivateKey>(PrivateKey::FromDER(
+            reinterpret_cast<const unsigned char *>(private_key.data()), private_key.size()));
+    }
+    else
     {
-        body.resize(content_length);
-        request_stream.read(&body[0], content_length);
-        if (request_stream.gcount() < content_length)
+        std::string key = json_unescape(private_key);
+        if (key.compare(0, 10, "-----BEGIN") == 0)
+            priv = std::make_shared<PrivateKey>(PrivateKey::FromPEM(key));
+        else
         {
-            // Need to read more
-            ssize_t remaining = content_length - request_stream.gcount();
-            ssize_t extra = recv(client_socket, &body[request_stream.gcount()], remaining, 0);
-            if (extra <= 0)
-            {
-                std::cerr << "[" << current_timestamp() << "] Error reading request body from " << client_ip << ":" << client_port << "\n";
-                close(client_socket);
-                return;
-            }
-            body.resize(request_stream.gcount() + extra);
+            // "n-d" carries no factors; recover them once per cached key so
+            // the key still decrypts with the CRT
+            priv = std::make_shared<PrivateKey>(PrivateKey::FromHexa(key));
+            priv->RecoverFactors();
         }
     }
 
-    std::cout << "[" << current_timestamp() << "] Request Body: " << body << "\n";
+    std::lock_guard<std::mutex> lock(private_key_cache_mutex);
+    if (private_key_cache.size() >= PRIVATE_KEY_CACHE_SIZE)
+        private_key_cache.clear();
+    private_key_cache[cache_key] = priv;
+    return priv;
+}
 
-    // Prepare the response
-    std::string response;
+// Function to parse a private key given as PEM, hexa ("n-d") or base64 DER
+std::shared_ptr<const PrivateKey> parse_private_key(const std::string &private_key, Encoding encoding)
+{
+    if (encoding == Encoding::Hex || private_key.compare(0, 10, "-----BEGIN") == 0)
+        return get_private_key(private_key);
+    std::vector<unsigned char> der = decode_bytes(json_unescape(private_key), encoding);
+    return get_private_key(std::string(der.begin(), der.end()), true);
+}
 
-    // Handle different endpoints
-    if (path == "/generate_keys" && method == "POST")
+// Function to read the "keysize" field of a JSON request body; 0 when missing or invalid
+int parse_keysize(const std::string &body)
+{
+    int keysize = 0;
+    size_t pos = body.find("\"keysize\"");
+    if (pos != std::string::npos)
     {
-        std::cout << "[" << current_timestamp() << "] Handling /generate_keys\n";
-        // Expecting JSON: {"keysize": 2048}
-        // Simple JSON parsing
-        int keysize = 0;
-        size_t pos = body.find("\"keysize\"");
-        if (pos != std::string::npos)
+        size_t colon = body.find(':', pos);
+        if (colon != std::string::npos)
         {
-            size_t colon = body.find(':', pos);
-            if (colon != std::string::npos)
+            size_t end = body.find_first_of(",}", colon);
+            if (end != std::string::npos)
             {
-                size_t end = body.find_first_of(",}", colon);
-                if (end != std::string::npos)
+                std::string keysize_str = body.substr(colon + 1, end - colon - 1);
+                try
                 {
-                    std::string keysize_str = body.substr(colon + 1, end - colon - 1);
-                    try
-                    {
-                        keysize = std::stoi(keysize_str);
-                    }
-                    catch (...)
-                    {
-                        keysize = 0;
-                    }
+                    keysize = std::stoi(keysize_str);
+                }
+                catch (...)
+                {
+                    keysize = 0;
                 }
             }
         }
+    }
+    return keysize;
+}
 
-        std::cout << "[" << current_timestamp() << "] Keysize requested: " << keysize << "\n";
+// Function to persist a new key pair when the key store is enabled; returns its id or ""
+std::string store_key_pair(const PublicKey &pub, const PrivateKey &priv)
+{
+    if (!key_store)
+        return "";
+    std::string key_id = KeyStore::IdToString(key_store->Append(pub, priv));
+    std::cout << "[" << current_timestamp() << "] Stored key " << key_id << "\n";
+    return key_id;
+}
 
-        if (keysize < 512 || keysize % 64 != 0)
-        {
-            std::cerr << "[" << current_timestamp() << "] Invalid keysize: " << keysize << "\n";
-            std::ostringstream oss;
-            oss << "HTTP/1.1 400 Bad Request\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Content-Length: 0\r\n"
-                << "Connection: close\r\n"
-                << "\r\n";
-            response = oss.str();
-            send_response(client_socket, response);
-            close(client_socket);
-            return;
-        }
+// Function to format a key pair as the /generate_keys JSON body
+std::string key_pair_json(const PublicKey &pub, const PrivateKey &priv, const std::string &key_id, Encoding encoding = Encoding::Hex)
+{
+    std::string public_key = encoding == Encoding::Hex ? pub.ToHexa() : encode_bytes(pub.ToDER(), encoding);
+    std::string private_key = encoding == Encoding::Hex ? priv.ToHexa() : encode_bytes(priv.ToDER(), encoding);
+    return "{ \"public_key\": \"" + public_key + "\", \"private_key\": \"" + private_key + "\"" +
+           (key_id.empty() ? "" : ", \"key_id\": \"" + key_id + "\"") + " }";
+}
 
-        try
+// Watches the sockets of clients waiting on long work (key generation) and
+// cancels their token when the peer hangs up. One thread polls every watched
+// socket; it sleeps while nothing is registered.
+//
+// A FIN (POLLRDHUP) alone does not mean the client is gone: curl and nc -N
+// half-close after sending the request and keep reading. A peer that really
+// closed resets the connection only once data reaches it, so an HTTP/1.1
+// client that sent FIN gets an interim "102 Processing" response, which
+// clients must skip, and the token is cancelled on POLLHUP/POLLERR only.
+class HangupWatcher
+{
+public:
+    // Register fd for the lifetime of the returned guard
+    class Guard
+    {
+    public:
+        Guard(HangupWatcher &watcher, const HttpRequest &request, CancellationToken &token) : watcher(watcher), fd(request.fd)
         {
-            PublicKey pub;
-            PrivateKey priv;
-            CreateRSAKey(keysize, false, false, pub, priv);
-
-            std::string public_key = pub.ToHexa();
-            std::string private_key = priv.ToHexa();
-
-            // Create JSON response
-            std::string json_response = "{ \"public_key\": \"" + public_key + "\", \"private_key\": \"" + private_key + "\" }";
-
-            // Create HTTP response
-            std::ostringstream oss;
-            oss << "HTTP/1.1 200 OK\r\n"
-                << "Content-Type: application/json\r\n"
-                << "Content-Length: " << json_response.length() << "\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Connection: close\r\n"
-                << "\r\n"
-                << json_response;
-
-            response = oss.str();
-            std::cout << "[" << current_timestamp() << "] /generate_keys response: " << json_response << "\n";
+            // 1xx responses must not be sent to HTTP/1.0 clients
+            if (fd >= 0)
+                watcher.Add(fd, &token, request.http_version == "HTTP/1.1");
         }
-        catch (const std::exception &e)
+        ~Guard()
         {
-            std::cerr << "[" << current_timestamp() << "] Exception in /generate_keys: " << e.what() << "\n";
-            std::ostringstream oss;
-            oss << "HTTP/1.1 500 Internal Server Error\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Content-Length: 0\r\n"
-                << "Connection: close\r\n"
-                << "\r\n";
-            response = oss.str();
-            send_response(client_socket, response);
-            close(client_socket);
-            return;
+            if (fd >= 0)
+                watcher.Remove(fd);
         }
-    }
-    else if (path == "/encrypt" && method == "POST")
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+    private:
+        HangupWatcher &watcher;
+        int fd;
+    };
+
+private:
+    static const int POLL_INTERVAL_MS = 50;
+
+    struct Watched
     {
-        std::cout << "[" << current_timestamp() << "] Handling /encrypt\n";
-        // Expecting JSON: { "public_key": "...", "plaintext": "..." }
-        // Simple JSON parsing
-        std::string public_key;
-        std::string plaintext;
+        CancellationToken *token;
+        bool interimAllowed; // the client speaks HTTP/1.1
+        bool halfClosed;     // the peer sent FIN; only a reset or hangup cancels now
+    };
 
-        size_t pos_pub = body.find("\"public_key\"");
-        if (pos_pub != std::string::npos)
+    void Add(int fd, CancellationToken *token, bool interimAllowed)
+    {
         {
-            size_t colon = body.find(':', pos_pub);
-            size_t quote1 = body.find('\"', colon);
-            size_t quote2 = body.find('\"', quote1 + 1);
-            if (quote1 != std::string::npos && quote2 != std::string::npos && quote2 > quote1)
-                public_key = body.substr(quote1 + 1, quote2 - quote1 - 1);
+            std::lock_guard<std::mutex> lock(mutex);
+            watched[fd] = Watched{token, interimAllowed, false};
+            if (!started)
+            {
+                started = true;
+                std::thread(&HangupWatcher::Run, this).detach();
+            }
         }
+        changed.notify_one();
+    }
 
-        size_t pos_pt = body.find("\"plaintext\"");
-        if (pos_pt != std::string::npos)
+    void Remove(int fd)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        watched.erase(fd);
+    }
+
+    void Run()
+    {
+        std::vector<pollfd> fds;
+        while (true)
         {
-            size_t colon = body.find(':', pos_pt);
-            size_t quote1 = body.find('\"', colon);
-            size_t quote2 = body.find('\"', quote1 + 1);
-            if (quote1 != std::string::npos && quote2 != std::string::npos && quote2 > quote1)
-                plaintext = body.substr(quote1 + 1, quote2 - quote1 - 1);
-        }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]()
+                             { return !watched.empty(); });
+                fds.clear();
+                // POLLHUP and POLLERR are reported even when not requested
+                for (const auto &entry : watched)
+                    fds.push_back(pollfd{entry.first, static_cast<short>(entry.second.halfClosed ? 0 : HANGUP_EVENTS), 0});
+            }
 
-        std::cout << "[" << current_timestamp() << "] Public Key: " << public_key << "\n";
-        std::cout << "[" << current_timestamp() << "] Plaintext: " << plaintext << "\n";
+            if (poll(fds.data(), fds.size(), POLL_INTERVAL_MS) <= 0)
+                continue;
 
-        if (public_key.empty() || plaintext.empty())
-        {
-            std::cerr << "[" << current_timestamp() << "] Missing public_key or plaintext in /encrypt request.\n";
-            std::ostringstream oss;
-            oss << "HTTP/1.1 400 Bad Request\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Content-Length: 0\r\n"
-                << "Connection: close\r\n"
-                << "\r\n";
-            response = oss.str();
-            send_response(client_socket, response);
-            close(client_socket);
-            return;
+            // Only cancel sockets still registered; the guard may have gone
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const pollfd &p : fds)
+            {
+                if (!p.revents)
+                    continue;
+                auto it = watched.find(p.fd);
+                if (it == watched.end())
+                    continue;
+                if (!(p.revents & (POLLHUP | POLLERR)))
+                {
+                    it->second.halfClosed = true;
+                    if (it->second.interimAllowed)
+                        probe_peer(p.fd);
+                    continue;
+                }
+                it->second.token->Cancel();
+                watched.erase(it);
+                std::cout << "[" << current_timestamp() << "] Client on fd " << p.fd << " hung up, cancelling its work\n";
+            }
         }
+    }
 
-        try
-        {
-            // Parse public key
-            size_t dash = public_key.find('-');
-            if (dash == std::string::npos)
-                throw std::runtime_error("Invalid public key format");
+    // Send an interim response: a closed peer resets the connection, which
+    // the next poll reports, while a peer still reading skips it. Called
+    // with the lock held, so the guard cannot have handed the socket back
+    // to its response writer yet.
+    static void probe_peer(int fd)
+    {
+        static const char PROCESSING[] = "HTTP/1.1 102 Processing\r\n\r\n";
+        if (send(fd, PROCESSING, sizeof(PROCESSING) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+            std::cerr << "[" << current_timestamp() << "] Probe of fd " << fd << " failed: " << strerror(errno) << "\n";
+    }
 
-            PublicKey pub;
-            pub.nn.set_str(public_key.substr(0, dash), 16);
-            pub.ee.set_str(public_key.substr(dash + 1), 16);
+#ifdef POLLRDHUP
+    static const short HANGUP_EVENTS = POLLRDHUP;
+#else
+    static const short HANGUP_EVENTS = POLLHUP;
+#endif
 
-            // Convert plaintext to byte vector
-            std::vector<unsigned char> plaintext_bytes(plaintext.begin(), plaintext.end());
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<int, Watched> watched;
+    bool started = false;
+};
 
-            // Encrypt
-            std::vector<unsigned char> encrypted = pub.Encrypt(plaintext_bytes);
+HangupWatcher hangup_watcher;
 
-            // Convert encrypted bytes to hex string
-            std::ostringstream enc_hex;
-            for (auto byte : encrypted)
-            {
-                enc_hex << std::hex << std::setw(2) << std::setfill('0') << (int)byte;
-            }
-            std::string encrypted_text = enc_hex.str();
+// Deadline for one key generation, set with --keygen-timeout (0 = none)
+int keygen_timeout_seconds = 0;
 
-            // Create JSON response
-            std::string json_response = "{ \"encrypted_text\": \"" + encrypted_text + "\" }";
+// Function to start a cancellation token with the keygen deadline applied
+void start_keygen_deadline(CancellationToken &token)
+{
+    if (keygen_timeout_seconds > 0)
+        token.SetDeadline(std::chrono::steady_clock::now() + std::chrono::seconds(keygen_timeout_seconds));
+}
 
-            // Create HTTP response
-            std::ostringstream oss;
-            oss << "HTTP/1.1 200 OK\r\n"
-                << "Content-Type: application/json\r\n"
-                << "Content-Length: " << json_response.length() << "\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Connection: close\r\n"
-                << "\r\n"
-                << json_response;
-
-            response = oss.str();
-            std::cout << "[" << current_timestamp() << "] /encrypt response: " << json_response << "\n";
-        }
-        catch (const std::exception &e)
-        {
-            std::cerr << "[" << current_timestamp() << "] Exception in /encrypt: " << e.what() << "\n";
-            std::ostringstream oss;
-            oss << "HTTP/1.1 500 Internal Server Error\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Content-Length: 0\r\n"
-                << "Connection: close\r\n"
-                << "\r\n";
-            response = oss.str();
-            send_response(client_socket, response);
-            close(client_socket);
-            return;
-        }
-    }
-    else if (path == "/decrypt" && method == "POST")
+// Fixed-bucket histogram rendered in the Prometheus text format
+class Histogram
+{
+public:
+    explicit Histogram(std::vector<double> bounds) : bounds(std::move(bounds)), counts(this->bounds.size() + 1, 0) {}
+
+    void Observe(double value)
     {
-        std::cout << "[" << current_timestamp() << "] Handling /decrypt\n";
-        // Expecting JSON: { "private_key": "...", "encrypted_text": "..." }
-        // Simple JSON parsing
-        std::string private_key;
-        std::string encrypted_text;
+        size_t i = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+        counts[i]++;
+        sum += value;
+    }
 
-        size_t pos_priv = body.find("\"private_key\"");
-        if (pos_priv != std::string::npos)
+    void Render(std::ostringstream &oss, const std::string &name) const
+    {
+        oss << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < bounds.size(); i++)
         {
-            size_t colon = body.find(':', pos_priv);
-            size_t quote1 = body.find('\"', colon);
-            size_t quote2 = body.find('\"', quote1 + 1);
-            if (quote1 != std::string::npos && quote2 != std::string::npos && quote2 > quote1)
-                private_key = body.substr(quote1 + 1, quote2 - quote1 - 1);
+            cumulative += counts[i];
+            oss << name << "_bucket{le=\"" << bounds[i] << "\"} " << cumulative << "\n";
         }
+        cumulative += counts.back();
+        oss << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+        oss << name << "_sum " << sum << "\n";
+        oss << name << "_count " << cumulative << "\n";
+    }
 
-        size_t pos_enc = body.find("\"encrypted_text\"");
-        if (pos_enc != std::string::npos)
-        {
-            size_t colon = body.find(':', pos_enc);
-            size_t quote1 = body.find('\"', colon);
-            size_t quote2 = body.find('\"', quote1 + 1);
-            if (quote1 != std::string::npos && quote2 != std::string::npos && quote2 > quote1)
-                encrypted_text = body.substr(quote1 + 1, quote2 - quote1 - 1);
-        }
+private:
+    std::vector<double> bounds;
+    std::vector<uint64_t> counts; // per bucket, the last one above every bound
+    double sum = 0;
+};
 
-        std::cout << "[" << current_timestamp() << "] Private Key: " << private_key << "\n";
-        std::cout << "[" << current_timestamp() << "] Encrypted Text: " << encrypted_text << "\n";
+// Totals over every completed key generation, exported by GET /metrics
+struct KeygenMetrics
+{
+    std::mutex mutex;
+    uint64_t keys = 0;
+    KeygenStats totals;
+    Histogram primalityTests{{16, 32, 64, 128, 256, 512, 1024, 2048}};
+    Histogram seconds{{0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10}};
+};
+KeygenMetrics keygen_metrics;
+
+// Function to add one key generation to the metrics
+void record_keygen(const KeygenStats &stats)
+{
+    std::lock_guard<std::mutex> lock(keygen_metrics.mutex);
+    keygen_metrics.keys++;
+    keygen_metrics.totals += stats;
+    keygen_metrics.primalityTests.Observe(stats.primalityTests);
+    keygen_metrics.seconds.Observe(stats.seconds);
+}
 
-        if (private_key.empty() || encrypted_text.empty())
-        {
-            std::cerr << "[" << current_timestamp() << "] Missing private_key or encrypted_text in /decrypt request.\n";
-            std::ostringstream oss;
-            oss << "HTTP/1.1 400 Bad Request\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Content-Length: 0\r\n"
-                << "Connection: close\r\n"
-                << "\r\n";
-            response = oss.str();
-            send_response(client_socket, response);
-            close(client_socket);
-            return;
-        }
+// Deterministic keygen for reproducible benchmarks (--keygen-seed): key n
+// generated since startup uses the seed plus n, and /generate_keys accepts an
+// explicit "seed". Anyone who knows the seed can recompute the keys, so the
+// mode is off unless the flag is given.
+bool keygen_seeded = false;
+uint64_t keygen_base_seed = 0;
+std::atomic<uint64_t> keygen_sequence{0};
+
+// Function to pick the seed of one key generation; nullptr (a random key)
+// outside deterministic mode
+const uint64_t *next_keygen_seed(uint64_t &seed)
+{
+    if (!keygen_seeded)
+        return nullptr;
+    seed = keygen_base_seed + keygen_sequence++;
+    return &seed;
+}
 
-        try
-        {
-            // Parse private key
-            size_t dash = private_key.find('-');
-            if (dash == std::string::npos)
-                throw std::runtime_error("Invalid private key format");
+// Background keygen jobs, started in main()
+std::unique_ptr<KeygenScheduler> keygen_jobs;
+const int MAX_JOB_WAIT_SECONDS = 30;
 
-            PrivateKey priv;
-            priv.nn.set_str(private_key.substr(0, dash), 16);
-            priv.dd.set_str(private_key.substr(dash + 1), 16);
+// Most keys one /generate_keys_batch request may ask for
+const uint64_t MAX_BATCH_KEYS = 10000;
 
-            // Convert encrypted hex string to byte vector
-            std::vector<unsigned char> encrypted_bytes;
-            if (encrypted_text.length() % 2 != 0)
-                throw std::runtime_error("Invalid encrypted_text length");
+// Function to generate, store and format one key pair for a keygen job
+std::string generate_key_job(int keysize, const std::string &encoding_name)
+{
+    Encoding encoding = Encoding::Hex;
+    parse_encoding_name(encoding_name, encoding);
+    PublicKey pub;
+    PrivateKey priv;
+    CancellationToken cancel;
+    start_keygen_deadline(cancel);
+    uint64_t seed;
+    record_keygen(CreateRSAKey(keysize, false, false, pub, priv, &cancel, next_keygen_seed(seed)));
+    std::string key_id = store_key_pair(pub, priv);
+    return key_pair_json(pub, priv, key_id, encoding);
+}
 
-            for (size_t i = 0; i < encrypted_text.length(); i += 2)
-            {
-                std::string byte_str = encrypted_text.substr(i, 2);
-                unsigned char byte = static_cast<unsigned char>(strtol(byte_str.c_str(), nullptr, 16));
-                encrypted_bytes.push_back(byte);
-            }
+// Function to format a keygen job as JSON
+std::string job_json(const KeygenJobStatus &job)
+{
+    std::string json = std::string("{ \"job_id\": \"") + job.id + "\", \"status\": \"" + job.StateName() + "\", \"keysize\": " + std::to_string(job.keysize);
+    if (job.state == KeygenJobStatus::Done)
+        json += ", \"result\": " + job.result;
+    else if (job.state == KeygenJobStatus::Failed)
+        json += ", \"error\": \"" + json_escape(job.error) + "\"";
+    return json + " }";
+}
 
-            // Decrypt
-            std::vector<unsigned char> decrypted = priv.Decrypt(encrypted_bytes);
+// Function to get the encoded size of the DER SEQUENCE at the start of data
+size_t der_sequence_size(const std::string &data)
+{
+    if (data.size() < 2 || static_cast<unsigned char>(data[0]) != 0x30)
+        throw std::runtime_error("Invalid DER key");
+    size_t length = static_cast<unsigned char>(data[1]);
+    size_t header = 2;
+    if (length & 0x80)
+    {
+        size_t count = length & 0x7f;
+        if (count == 0 || count > 4 || data.size() < 2 + count)
+            throw std::runtime_error("Invalid DER key");
+        length = 0;
+        for (size_t i = 0; i < count; i++)
+            length = (length << 8) | static_cast<unsigned char>(data[2 + i]);
+        header += count;
+    }
+    if (header + length > data.size())
+        throw std::runtime_error("Truncated DER key");
+    return header + length;
+}
 
-            // Convert decrypted bytes to string
-            std::string decrypted_text(decrypted.begin(), decrypted.end());
+std::deque<ShardMetrics> shard_metrics;
 
-            // Create JSON response
-            std::string json_response = "{ \"decrypted_text\": \"" + decrypted_text + "\" }";
+// Requests answered 413 or 431 by the size limits, by any backend
+static std::atomic<uint64_t> rejected_body_too_large{0};
+static std::atomic<uint64_t> rejected_head_too_large{0};
 
-            // Create HTTP response
-            std::ostringstream oss;
-            oss << "HTTP/1.1 200 OK\r\n"
-                << "Content-Type: application/json\r\n"
-                << "Content-Length: " << json_response.length() << "\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Connection: close\r\n"
-                << "\r\n"
-                << json_response;
-
-            response = oss.str();
-            std::cout << "[" << current_timestamp() << "] /decrypt response: " << json_response << "\n";
+// Function to render the metrics in Prometheus text format
+std::string render_metrics()
+{
+    std::ostringstream oss;
+    oss << "# TYPE rsa_shard_connections_accepted_total counter\n";
+    for (size_t i = 0; i < shard_metrics.size(); i++)
+        oss << "rsa_shard_connections_accepted_total{shard=\"" << i << "\"} " << shard_metrics[i].accepted << "\n";
+    oss << "# TYPE rsa_shard_connections_active gauge\n";
+    for (size_t i = 0; i < shard_metrics.size(); i++)
+        oss << "rsa_shard_connections_active{shard=\"" << i << "\"} " << shard_metrics[i].active << "\n";
+    if (keygen_jobs)
+    {
+        oss << "# TYPE rsa_keygen_jobs_pending gauge\n";
+        oss << "rsa_keygen_jobs_pending " << keygen_jobs->Pending() << "\n";
+    }
+    {
+        std::lock_guard<std::mutex> lock(keygen_metrics.mutex);
+        const KeygenStats &totals = keygen_metrics.totals;
+        oss << "# TYPE rsa_keygen_keys_total counter\n";
+        oss << "rsa_keygen_keys_total " << keygen_metrics.keys << "\n";
+        oss << "# TYPE rsa_keygen_candidates_total counter\n";
+        oss << "rsa_keygen_candidates_total " << totals.candidates << "\n";
+        oss << "# TYPE rsa_keygen_sieve_rejections_total counter\n";
+        oss << "rsa_keygen_sieve_rejections_total " << totals.sieveRejections << "\n";
+        oss << "# TYPE rsa_keygen_primality_tests_total counter\n";
+        oss << "rsa_keygen_primality_tests_total " << totals.primalityTests << "\n";
+        oss << "# TYPE rsa_keygen_miller_rabin_rounds_total counter\n";
+        oss << "rsa_keygen_miller_rabin_rounds_total " << totals.millerRabinRounds << "\n";
+        oss << "# TYPE rsa_keygen_bit_size_rejections_total counter\n";
+        oss << "rsa_keygen_bit_size_rejections_total " << totals.bitSizeRejections << "\n";
+        oss << "# TYPE rsa_keygen_equal_prime_retries_total counter\n";
+        oss << "rsa_keygen_equal_prime_retries_total " << totals.equalPrimeRetries << "\n";
+        oss << "# TYPE rsa_keygen_exponent_searches_total counter\n";
+        oss << "rsa_keygen_exponent_searches_total " << totals.exponentSearches << "\n";
+        oss << "# TYPE rsa_keygen_cached_primes_total counter\n";
+        oss << "rsa_keygen_cached_primes_total " << totals.cachedPrimes << "\n";
+        keygen_metrics.primalityTests.Render(oss, "rsa_keygen_primality_tests");
+        keygen_metrics.seconds.Render(oss, "rsa_keygen_duration_seconds");
+    }
+    {
+        CrtCounters crt = GetCrtCounters();
+        oss << "# TYPE rsa_private_exponentiations_total counter\n";
+        oss << "rsa_private_exponentiations_total{mode=\"full\"} " << crt.full << "\n";
+        oss << "rsa_private_exponentiations_total{mode=\"crt_serial\"} " << crt.serial << "\n";
+        oss << "rsa_private_exponentiations_total{mode=\"crt_parallel\"} " << crt.parallel << "\n";
+        oss << "# TYPE rsa_crt_reclaimed_halves_total counter\n";
+        oss << "rsa_crt_reclaimed_halves_total " << crt.reclaimed << "\n";
+        oss << "# TYPE rsa_crt_faults_total counter\n";
+        oss << "rsa_crt_faults_total " << crt.faults << "\n";
+    }
+    if (PrimeCache *cache = GetPrimeCache())
+    {
+        oss << "# TYPE rsa_prime_cache_primes gauge\n";
+        for (int bits : cache->PrimeBits())
+            oss << "rsa_prime_cache_primes{bits=\"" << bits << "\"} " << cache->Stock(bits) << "\n";
+        oss << "# TYPE rsa_prime_cache_hits_total counter\n";
+        oss << "rsa_prime_cache_hits_total " << cache->Hits() << "\n";
+        oss << "# TYPE rsa_prime_cache_misses_total counter\n";
+        oss << "rsa_prime_cache_misses_total " << cache->Misses() << "\n";
+        oss << "# TYPE rsa_prime_cache_harvested_total counter\n";
+        oss << "rsa_prime_cache_harvested_total " << cache->Harvested() << "\n";
+    }
+    oss << "# TYPE rsa_receive_buffers_in_use gauge\n";
+    oss << "rsa_receive_buffers_in_use " << receive_buffers().InUse() << "\n";
+    oss << "# TYPE rsa_receive_buffers_idle gauge\n";
+    oss << "rsa_receive_buffers_idle " << receive_buffers().Idle() << "\n";
+    oss << "# TYPE rsa_requests_rejected_total counter\n";
+    oss << "rsa_requests_rejected_total{status=\"413\"} " << rejected_body_too_large << "\n";
+    oss << "rsa_requests_rejected_total{status=\"431\"} " << rejected_head_too_large << "\n";
+    return oss.str();
+}
+
+// Function to parse the request line and headers of a raw request. Returns the
+// offset of the body, or std::string::npos while the header block is incomplete.
+size_t parse_request_head(const std::string &raw, HttpRequest &request, size_t &content_length)
+{
+    size_t header_end = raw.find("\r\n\r\n");
+    if (header_end == std::string::npos)
+        return std::string::npos;
+
+    std::istringstream request_stream(raw.substr(0, header_end + 2));
+    std::string request_line;
+    std::getline(request_stream, request_line);
+
+    // Parse the request line
+    std::istringstream request_line_stream(request_line);
+    request_line_stream >> request.method >> request.path >> request.http_version;
+
+    // Parse headers
+    std::string headers;
+    std::string header_line;
+    while (std::getline(request_stream, header_line) && header_line != "\r")
+    {
+        headers += header_line + "\n";
+    }
+    request.headers = parse_headers(headers);
+
+    // Determine content length
+    content_length = 0;
+    auto it = request.headers.find("Content-Length");
+    if (it != request.headers.end())
+    {
+        const std::string &value = it->second;
+        if (!value.empty() && value.find_first_not_of("0123456789") == std::string::npos)
+        {
+            errno = 0;
+            unsigned long long length = strtoull(value.c_str(), nullptr, 10);
+            // Out of range lengths saturate so the size limit rejects them
+            content_length = errno == ERANGE || length > SIZE_MAX ? SIZE_MAX : static_cast<size_t>(length);
+        }
+        else
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid Content-Length from " << request.peer << "\n";
+        }
+    }
+    return header_end + 4;
+}
+
+// Largest request body accepted, set with --max-body-size
+size_t max_body_size = 8 * 1024 * 1024;
+
+// Function to check a request being read against the size limits
+bool request_within_limits(HttpRequest &request, size_t received, size_t body_offset, size_t content_length)
+{
+    if (body_offset == std::string::npos && received > MAX_REQUEST_HEAD)
+        request.reject_status = 431;
+    else if (body_offset != std::string::npos && content_length > max_body_size)
+        request.reject_status = 413;
+    return request.reject_status == 0;
+}
+
+// Function to run the endpoint for a complete request and build the HTTP response
+static HttpResponse route_request(const HttpRequest &request)
+{
+    if (request.reject_status != 0)
+    {
+        std::cerr << "[" << current_timestamp() << "] Rejecting oversized request from " << request.peer << " with " << request.reject_status << "\n";
+        (request.reject_status == 413 ? rejected_body_too_large : rejected_head_too_large)++;
+        return HttpResponse(request.reject_status);
+    }
+
+    const std::string &method = request.method;
+    const std::string &path = request.path;
+    const std::string &body = request.body;
+    const std::map<std::string, std::string> &header_map = request.headers;
+    std::string content_type = media_type(header_map, "Content-Type");
+    std::string accept = media_type(header_map, "Accept");
+
+    // Handle preflight OPTIONS request
+    if (method == "OPTIONS") {
+        std::cout << "[" << current_timestamp() << "] Handling OPTIONS request from " << request.peer << "\n";
+        return HttpResponse::Preflight();
+    }
+
+    if (content_type == "application/octet-stream")
+        std::cout << "[" << current_timestamp() << "] Request Body: " << body.size() << " binary bytes\n";
+    else
+        std::cout << "[" << current_timestamp() << "] Request Body: " << body << "\n";
+
+    // Prepare the response
+    HttpResponse response;
+
+    // Handle different endpoints
+    if (path == "/generate_keys" && method == "POST")
+    {
+        std::cout << "[" << current_timestamp() << "] Handling /generate_keys\n";
+        // Expecting JSON: {"keysize": 2048}, optionally with "encoding": "base64"
+        int keysize = parse_keysize(body);
+
+        std::cout << "[" << current_timestamp() << "] Keysize requested: " << keysize << "\n";
+
+        if (keysize < 512 || keysize % 64 != 0)
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid keysize: " << keysize << "\n";
+            return HttpResponse(400);
+        }
+
+        Encoding encoding;
+        if (!parse_encoding(body, encoding))
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid encoding in /generate_keys request.\n";
+            return HttpResponse(400);
+        }
+
+        // An explicit seed makes the key reproducible; refused unless the
+        // server runs in deterministic mode
+        uint64_t seed;
+        const uint64_t *keygen_seed = nullptr;
+        if (body.find("\"seed\"") != std::string::npos)
+        {
+            if (!keygen_seeded || !json_uint_field(body, "seed", seed))
+            {
+                std::cerr << "[" << current_timestamp() << "] " << (keygen_seeded ? "Invalid seed" : "Seeded keygen is disabled (see --keygen-seed)") << " in /generate_keys request.\n";
+                return HttpResponse(400);
+            }
+            keygen_seed = &seed;
+        }
+        else
+        {
+            keygen_seed = next_keygen_seed(seed);
+        }
+
+        try
+        {
+            // Abort the search when the client hangs up or the deadline passes
+            PublicKey pub;
+            PrivateKey priv;
+            CancellationToken cancel;
+            start_keygen_deadline(cancel);
+            {
+                HangupWatcher::Guard watch(hangup_watcher, request, cancel);
+                TraceSpan span("keygen");
+                record_keygen(CreateRSAKey(keysize, false, false, pub, priv, &cancel, keygen_seed));
+            }
+
+            std::string key_id = store_key_pair(pub, priv);
+
+            // Binary clients get the keys back-to-back; DER is self-delimiting
+            if (accept == "application/octet-stream" || accept == "application/x-pem-file")
+            {
+                std::string keys;
+                if (accept == "application/octet-stream")
+                {
+                    std::vector<unsigned char> pub_der = pub.ToDER();
+                    std::vector<unsigned char> priv_der = priv.ToDER();
+                    keys.assign(pub_der.begin(), pub_der.end());
+                    keys.append(priv_der.begin(), priv_der.end());
+                }
+                else
+                {
+                    keys = pub.ToPEM() + priv.ToPEM();
+                }
+                std::cout << "[" << current_timestamp() << "] /generate_keys sent " << keys.size() << " bytes as " << accept << "\n";
+                HttpResponse keys_response = HttpResponse::Content(accept, std::move(keys));
+                if (!key_id.empty())
+                    keys_response.AddHeader("X-Key-Id", key_id);
+                return keys_response;
+            }
+
+            // Create JSON response
+            std::string json_response = key_pair_json(pub, priv, key_id, encoding);
+
+            std::cout << "[" << current_timestamp() << "] /generate_keys response: " << json_response << "\n";
+            response = HttpResponse::Json(std::move(json_response));
+        }
+        catch (const KeygenCancelled &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] /generate_keys: " << e.what() << "\n";
+            return HttpResponse(503);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] Exception in /generate_keys: " << e.what() << "\n";
+            return HttpResponse(500);
+        }
+    }
+    else if ((path == "/encrypt" || path == "/decrypt") && method == "POST" && content_type == "application/octet-stream")
+    {
+        std::cout << "[" << current_timestamp() << "] Handling binary " << path << "\n";
+        // Expecting a PKCS#1 DER key immediately followed by the raw payload,
+        // or only the payload when an X-Key-Id header names a stored key
+        auto key_id_header = header_map.find("X-Key-Id");
+        std::string key_id = key_id_header != header_map.end() ? key_id_header->second : "";
+        try
+        {
+            const unsigned char *data = reinterpret_cast<const unsigned char *>(body.data());
+            std::vector<unsigned char> result;
+            size_t key_size = 0;
+            if (path == "/encrypt")
+            {
+                PublicKey pub = key_id.empty() ? PublicKey::FromDER(data, body.size(), &key_size) : find_public_key(key_id);
+                result = pub.Encrypt(std::vector<unsigned char>(data + key_size, data + body.size()));
+            }
+            else
+            {
+                std::shared_ptr<const PrivateKey> priv;
+                if (key_id.empty())
+                {
+                    key_size = der_sequence_size(body);
+                    priv = get_private_key(body.substr(0, key_size), true);
+                }
+                else
+                {
+                    priv = find_private_key(key_id);
+                }
+                result = priv->Decrypt(std::vector<unsigned char>(data + key_size, data + body.size()));
+            }
+            response = HttpResponse::Content("application/octet-stream", std::string(result.begin(), result.end()));
+        }
+        catch (const KeyNotFound &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] " << e.what() << "\n";
+            return HttpResponse(404);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] Exception in binary " << path << ": " << e.what() << "\n";
+            return HttpResponse(400);
+        }
+    }
+    else if (path == "/encrypt" && method == "POST")
+    {
+        std::cout << "[" << current_timestamp() << "] Handling /encrypt\n";
+        // Expecting JSON: { "public_key": "...", "plaintext": "..." }
+        // Simple JSON parsing
+        std::string public_key;
+        std::string plaintext;
+
+        size_t pos_pub = body.find("\"public_key\"");
+        if (pos_pub != std::string::npos)
+        {
+            size_t colon = body.find(':', pos_pub);
+            size_t quote1 = body.find('\"', colon);
+            size_t quote2 = body.find('\"', quote1 + 1);
+            if (quote1 != std::string::npos && quote2 != std::string::npos && quote2 > quote1)
+                public_key = body.substr(quote1 + 1, quote2 - quote1 - 1);
+        }
+
+        size_t pos_pt = body.find("\"plaintext\"");
+        if (pos_pt != std::string::npos)
+        {
+            size_t colon = body.find(':', pos_pt);
+            size_t quote1 = body.find('\"', colon);
+            size_t quote2 = body.find('\"', quote1 + 1);
+            if (quote1 != std::string::npos && quote2 != std::string::npos && quote2 > quote1)
+                plaintext = body.substr(quote1 + 1, quote2 - quote1 - 1);
+        }
+
+        // A stored key can be referenced instead: { "key_id": "...", "plaintext": "..." }
+        std::string key_id = json_string_field(body, "key_id");
+
+        std::cout << "[" << current_timestamp() << "] Public Key: " << (key_id.empty() ? public_key : "id " + key_id) << "\n";
+        std::cout << "[" << current_timestamp() << "] Plaintext: " << plaintext << "\n";
+
+        if ((public_key.empty() && key_id.empty()) || plaintext.empty())
+        {
+            std::cerr << "[" << current_timestamp() << "] Missing public_key or plaintext in /encrypt request.\n";
+            return HttpResponse(400);
+        }
+
+        Encoding encoding;
+        if (!parse_encoding(body, encoding))
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid encoding in /encrypt request.\n";
+            return HttpResponse(400);
+        }
+
+        try
+        {
+            // Parse public key (PEM, hexa or base64 DER)
+            PublicKey pub;
+            {
+                TraceSpan span("key_import");
+                pub = key_id.empty() ? parse_public_key(public_key, encoding) : find_public_key(key_id);
+            }
+
+            // Convert plaintext to byte vector
+            std::vector<unsigned char> plaintext_bytes(plaintext.begin(), plaintext.end());
+
+            // Encrypt
+            std::vector<unsigned char> encrypted;
+            {
+                TraceSpan span("encrypt");
+                encrypted = pub.Encrypt(plaintext_bytes);
+            }
+
+            // Convert encrypted bytes to hex or base64
+            std::string encrypted_text;
+            {
+                TraceSpan span("encode");
+                encrypted_text = encode_bytes(encrypted, encoding);
+            }
+
+            // Create JSON response
+            std::string json_response = "{ \"encrypted_text\": \"" + encrypted_text + "\" }";
+
+            std::cout << "[" << current_timestamp() << "] /encrypt response: " << json_response << "\n";
+            response = HttpResponse::Json(std::move(json_response));
+        }
+        catch (const KeyNotFound &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] " << e.what() << "\n";
+            return HttpResponse(404);
+        }
+        catch (const InvalidKey &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid key in /encrypt: " << e.what() << "\n";
+            return HttpResponse(400);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] Exception in /encrypt: " << e.what() << "\n";
+            return HttpResponse(500);
+        }
+    }
+    else if (path == "/decrypt" && method == "POST")
+    {
+        std::cout << "[" << current_timestamp() << "] Handling /decrypt\n";
+        // Expecting JSON: { "private_key": "...", "encrypted_text": "..." }
+        // Simple JSON parsing
+        std::string private_key;
+        std::string encrypted_text;
+
+        size_t pos_priv = body.find("\"private_key\"");
+        if (pos_priv != std::string::npos)
+        {
+            size_t colon = body.find(':', pos_priv);
+            size_t quote1 = body.find('\"', colon);
+            size_t quote2 = body.find('\"', quote1 + 1);
+            if (quote1 != std::string::npos && quote2 != std::string::npos && quote2 > quote1)
+                private_key = body.substr(quote1 + 1, quote2 - quote1 - 1);
+        }
+
+        size_t pos_enc = body.find("\"encrypted_text\"");
+        if (pos_enc != std::string::npos)
+        {
+            size_t colon = body.find(':', pos_enc);
+            size_t quote1 = body.find('\"', colon);
+            size_t quote2 = body.find('\"', quote1 + 1);
+            if (quote1 != std::string::npos && quote2 != std::string::npos && quote2 > quote1)
+                encrypted_text = body.substr(quote1 + 1, quote2 - quote1 - 1);
+        }
+
+        // A stored key can be referenced instead: { "key_id": "...", "encrypted_text": "..." }
+        std::string key_id = json_string_field(body, "key_id");
+
+        std::cout << "[" << current_timestamp() << "] Private Key: " << (key_id.empty() ? private_key : "id " + key_id) << "\n";
+        std::cout << "[" << current_timestamp() << "] Encrypted Text: " << encrypted_text << "\n";
+
+        if ((private_key.empty() && key_id.empty()) || encrypted_text.empty())
+        {
+            std::cerr << "[" << current_timestamp() << "] Missing private_key or encrypted_text in /decrypt request.\n";
+            return HttpResponse(400);
+        }
+
+        Encoding encoding;
+        if (!parse_encoding(body, encoding))
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid encoding in /decrypt request.\n";
+            return HttpResponse(400);
+        }
+
+        try
+        {
+            // Parse private key (PEM, hexa or base64 DER; cached, so its blinding pair is reused)
+            std::shared_ptr<const PrivateKey> priv;
+            {
+                TraceSpan span("key_import");
+                priv = key_id.empty() ? parse_private_key(private_key, encoding) : find_private_key(key_id);
+            }
+
+            // Convert encrypted hex or base64 text to byte vector
+            std::vector<unsigned char> encrypted_bytes;
+            {
+                TraceSpan span("decode");
+                encrypted_bytes = decode_bytes(encrypted_text, encoding);
+            }
+
+            // Decrypt
+            std::vector<unsigned char> decrypted;
+            {
+                TraceSpan span("decrypt");
+                decrypted = priv->Decrypt(encrypted_bytes);
+            }
+
+            // Convert decrypted bytes to string
+            std::string decrypted_text(decrypted.begin(), decrypted.end());
+
+            // Create JSON response
+            std::string json_response = "{ \"decrypted_text\": \"" + decrypted_text + "\" }";
+
+            std::cout << "[" << current_timestamp() << "] /decrypt response: " << json_response << "\n";
+            response = HttpResponse::Json(std::move(json_response));
+        }
+        catch (const KeyNotFound &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] " << e.what() << "\n";
+            return HttpResponse(404);
+        }
+        catch (const InvalidKey &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid key in /decrypt: " << e.what() << "\n";
+            return HttpResponse(400);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] Exception in /decrypt: " << e.what() << "\n";
+            return HttpResponse(500);
+        }
+    }
+    else if (path == "/generate_keys_batch" && method == "POST")
+    {
+        std::cout << "[" << current_timestamp() << "] Handling /generate_keys_batch\n";
+        // Expecting JSON: { "count": 100, "keysize": 2048 }, optionally with
+        // "encoding". Keys are generated on every core and streamed in the
+        // order they finish, like /encrypt_batch results.
+        int keysize = parse_keysize(body);
+        uint64_t count = 0;
+        if (keysize < 512 || keysize % 64 != 0 || !json_uint_field(body, "count", count) || count == 0 || count > MAX_BATCH_KEYS)
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid keysize or count in /generate_keys_batch request.\n";
+            return HttpResponse(400);
+        }
+
+        Encoding encoding;
+        if (!parse_encoding(body, encoding))
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid encoding in /generate_keys_batch request.\n";
+            return HttpResponse(400);
+        }
+
+        bool ndjson = accept == "application/x-ndjson";
+        std::cout << "[" << current_timestamp() << "] Streaming " << count << " keys of " << keysize << " bits" << (ndjson ? " as NDJSON" : "") << "\n";
+        return HttpResponse::Stream(ndjson ? "application/x-ndjson" : "application/json",
+                                    [count, keysize, ndjson, encoding](ChunkWriter &out)
+                                    {
+            if (!ndjson && !out.Write("{ \"keys\": ["))
+                return;
+            CancellationToken cancel;
+            size_t sent = 0;
+            auto send_key = [&](const PublicKey &pub, const PrivateKey &priv, const KeygenStats &stats)
+            {
+                record_keygen(stats);
+                std::string key = key_pair_json(pub, priv, store_key_pair(pub, priv), encoding);
+                if (ndjson)
+                    key += "\n";
+                else if (sent > 0)
+                    key.insert(0, ", ");
+                sent++;
+                // Stop generating once the client has gone away
+                if (!out.Write(key))
+                    cancel.Cancel();
+            };
+            try
+            {
+                if (keygen_seeded)
+                {
+                    // Deterministic mode keeps one seed per key, in sequence
+                    for (uint64_t i = 0; i < count && !cancel.IsCancelled(); i++)
+                    {
+                        PublicKey pub;
+                        PrivateKey priv;
+                        uint64_t seed;
+                        send_key(pub, priv, CreateRSAKey(keysize, false, false, pub, priv, &cancel, next_keygen_seed(seed)));
+                    }
+                }
+                else
+                {
+                    CreateRSAKeys(count, keysize, 0, send_key, &cancel);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "[" << current_timestamp() << "] /generate_keys_batch stopped after " << sent << " keys: " << e.what() << "\n";
+                return;
+            }
+            if (!ndjson)
+                out.Write("] }"); });
+    }
+    else if ((path == "/encrypt_batch" || path == "/decrypt_batch") && method == "POST")
+    {
+        std::cout << "[" << current_timestamp() << "] Handling " << path << "\n";
+        // Expecting JSON: { "public_key": "...", "plaintexts": ["...", ...] } for
+        // /encrypt_batch, { "private_key": "...", "encrypted_texts": [...] } for
+        // /decrypt_batch, or "key_id" instead of the key. Results are streamed
+        // with chunked encoding as each item finishes, as one JSON document or
+        // as NDJSON lines when the client accepts application/x-ndjson.
+        bool encrypting = path == "/encrypt_batch";
+        std::string key_id = json_string_field(body, "key_id");
+        std::string key = json_string_field(body, encrypting ? "public_key" : "private_key");
+        std::vector<std::string> items = json_string_array(body, encrypting ? "plaintexts" : "encrypted_texts");
+
+        if ((key.empty() && key_id.empty()) || items.empty())
+        {
+            std::cerr << "[" << current_timestamp() << "] Missing key or items in " << path << " request.\n";
+            return HttpResponse(400);
+        }
+
+        Encoding encoding;
+        if (!parse_encoding(body, encoding))
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid encoding in " << path << " request.\n";
+            return HttpResponse(400);
+        }
+
+        std::shared_ptr<const PublicKey> pub;
+        std::shared_ptr<const PrivateKey> priv;
+        try
+        {
+            TraceSpan span("key_import");
+            if (encrypting)
+                pub = std::make_shared<PublicKey>(key_id.empty() ? parse_public_key(key, encoding) : find_public_key(key_id));
+            else
+                priv = key_id.empty() ? parse_private_key(key, encoding) : find_private_key(key_id);
+        }
+        catch (const KeyNotFound &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] " << e.what() << "\n";
+            return HttpResponse(404);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] Exception in " << path << ": " << e.what() << "\n";
+            return HttpResponse(400);
+        }
+
+        bool ndjson = accept == "application/x-ndjson";
+        std::cout << "[" << current_timestamp() << "] Streaming " << items.size() << " results" << (ndjson ? " as NDJSON" : "") << "\n";
+        return HttpResponse::Stream(ndjson ? "application/x-ndjson" : "application/json",
+                                    [pub, priv, items = std::move(items), ndjson, encoding](ChunkWriter &out)
+                                    {
+            if (!ndjson && !out.Write("{ \"results\": ["))
+                return;
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                std::string result = "{ \"index\": " + std::to_string(i) + ", ";
+                try
+                {
+                    TraceSpan span(pub ? "encrypt" : "decrypt");
+                    if (pub)
+                    {
+                        std::vector<unsigned char> plaintext(items[i].begin(), items[i].end());
+                        result += "\"encrypted_text\": \"" + encode_bytes(pub->Encrypt(plaintext), encoding) + "\" }";
+                    }
+                    else
+                    {
+                        std::vector<unsigned char> decrypted = priv->Decrypt(decode_bytes(items[i], encoding));
+                        result += "\"decrypted_text\": \"" + json_escape(std::string(decrypted.begin(), decrypted.end())) + "\" }";
+                    }
+                }
+                catch (const std::exception &e)
+                {
+                    result += "\"error\": \"" + json_escape(e.what()) + "\" }";
+                }
+
+                if (ndjson)
+                    result += "\n";
+                else if (i > 0)
+                    result.insert(0, ", ");
+                // Stop computing once the client has gone away
+                if (!out.Write(result))
+                    return;
+            }
+            if (!ndjson)
+                out.Write("] }"); });
+    }
+    else if (path == "/jobs/generate_keys" && method == "POST")
+    {
+        std::cout << "[" << current_timestamp() << "] Handling /jobs/generate_keys\n";
+        // Expecting the same JSON as /generate_keys; answers before the key exists
+        int keysize = parse_keysize(body);
+        if (keysize < 512 || keysize % 64 != 0)
+        {
+            std::cerr << "[" << current_timestamp() << "] Invalid keysize: " << keysize << "\n";
+            return HttpResponse(400);
         }
-        catch (const std::exception &e)
+
+        Encoding encoding;
+        std::string encoding_name = json_string_field(body, "encoding");
+        if (!parse_encoding_name(encoding_name, encoding))
         {
-            std::cerr << "[" << current_timestamp() << "] Exception in /decrypt: " << e.what() << "\n";
-            std::ostringstream oss;
-            oss << "HTTP/1.1 500 Internal Server Error\r\n"
-                << "Access-Control-Allow-Origin: *\r\n"
-                << "Content-Length: 0\r\n"
-                << "Connection: close\r\n"
-                << "\r\n";
-            response = oss.str();
-            send_response(client_socket, response);
-            close(client_socket);
-            return;
+            std::cerr << "[" << current_timestamp() << "] Invalid encoding in /jobs/generate_keys request.\n";
+            return HttpResponse(400);
+        }
+
+        try
+        {
+            std::string job_id = keygen_jobs->Submit(keysize, encoding_name.empty() ? "hex" : encoding_name);
+            std::cout << "[" << current_timestamp() << "] Queued keygen job " << job_id << " for " << keysize << " bits\n";
+            response = HttpResponse(202);
+            response.SetContent("application/json", "{ \"job_id\": \"" + job_id + "\", \"status\": \"queued\" }");
+            response.AddHeader("Location", "/jobs/" + job_id);
+        }
+        catch (const KeygenQueueFull &e)
+        {
+            std::cerr << "[" << current_timestamp() << "] " << e.what() << "\n";
+            return HttpResponse(503);
+        }
+    }
+    else if (path.compare(0, 6, "/jobs/") == 0 && method == "GET")
+    {
+        // GET /jobs/{id}[?wait=SECONDS] long-polls until the job finishes or the wait runs out
+        std::string job_id = path.substr(6);
+        int wait_seconds = 0;
+        size_t query = job_id.find('?');
+        if (query != std::string::npos)
+        {
+            size_t wait = job_id.find("wait=", query);
+            if (wait != std::string::npos)
+                wait_seconds = std::min(std::max(0, atoi(job_id.c_str() + wait + 5)), MAX_JOB_WAIT_SECONDS);
+            job_id.resize(query);
         }
+
+        // Answered when the job finishes or the wait runs out, without
+        // holding the thread that runs process_request meanwhile
+        return HttpResponse::Deferred([job_id, wait_seconds](HttpResponse::Completion done)
+                                      { keygen_jobs->Await(job_id, std::chrono::seconds(wait_seconds), [job_id, done](bool found, const KeygenJobStatus &job)
+                                                           {
+            if (!found)
+            {
+                std::cout << "[" << current_timestamp() << "] Unknown or expired job: " << job_id << "\n";
+                done(HttpResponse(404));
+                return;
+            }
+            std::cout << "[" << current_timestamp() << "] Job " << job_id << " is " << job.StateName() << "\n";
+            done(HttpResponse::Json(job_json(job))); }); });
+    }
+    else if (path == "/metrics" && method == "GET")
+    {
+        response = HttpResponse::Content("text/plain; version=0.0.4", render_metrics());
+    }
+    else if ((path == "/admin/trace" || path == "/admin/trace?clear=1") && method == "GET")
+    {
+        // Sampled request traces as Chrome trace-event JSON; ?clear=1 also empties the buffers
+        response = HttpResponse::Json(trace_export_chrome(path != "/admin/trace"));
     }
     else
     {
         std::cout << "[" << current_timestamp() << "] Unknown endpoint: " << path << "\n";
         // Not Found
-        std::ostringstream oss;
-        oss << "HTTP/1.1 404 Not Found\r\n"
-            << "Access-Control-Allow-Origin: *\r\n"
-            << "Content-Length: 0\r\n"
-            << "Connection: close\r\n"
-            << "\r\n";
-        response = oss.str();
-        send_response(client_socket, response);
+        return HttpResponse(404);
+    }
+
+    return response;
+}
+
+// Function to run the endpoint for a complete request, between the request probes
+HttpResponse process_request(const HttpRequest &request)
+{
+    RSA_PROBE2(request__start, request.method.c_str(), request.path.c_str());
+    HttpResponse response = route_request(request);
+    RSA_PROBE2(request__done, request.path.c_str(), response.Status());
+    return response;
+}
+
+// Function to run one binary protocol request; same operations as the HTTP endpoints
+BinaryResponse process_binary_request(const BinaryRequest &request)
+{
+    BinaryResponse response;
+    try
+    {
+        if (request.opcode == BIN_GENERATE)
+        {
+            int keysize = request.payload.size() == 4 ? static_cast<int>(get_be(reinterpret_cast<const unsigned char *>(request.payload.data()), 4)) : 0;
+            if (keysize < 512 || keysize % 64 != 0)
+            {
+                response.status = BIN_BAD_REQUEST;
+                response.payload = "Invalid keysize";
+                return response;
+            }
+
+            PublicKey pub;
+            PrivateKey priv;
+            CancellationToken cancel;
+            start_keygen_deadline(cancel);
+            uint64_t seed;
+            record_keygen(CreateRSAKey(keysize, false, false, pub, priv, &cancel, next_keygen_seed(seed)));
+            std::string key_id = store_key_pair(pub, priv);
+
+            std::vector<unsigned char> pub_der = pub.ToDER();
+            std::vector<unsigned char> priv_der = priv.ToDER();
+            put_be(response.payload, key_id.empty() ? 0 : KeyStore::IdFromString(key_id), 8);
+            put_be(response.payload, pub_der.size(), 2);
+            response.payload.append(pub_der.begin(), pub_der.end());
+            response.payload.append(priv_der.begin(), priv_der.end());
+            return response;
+        }
+
+        if (request.opcode != BIN_ENCRYPT && request.opcode != BIN_DECRYPT && request.opcode != BIN_SIGN)
+        {
+            response.status = BIN_BAD_REQUEST;
+            response.payload = "Unknown opcode";
+            return response;
+        }
+
+        std::string key_id;
+        if (request.keyType == BIN_KEY_ID)
+        {
+            if (request.key.size() != 8)
+            {
+                response.status = BIN_BAD_REQUEST;
+                response.payload = "Key id must be 8 bytes";
+                return response;
+            }
+            key_id = KeyStore::IdToString(get_be(reinterpret_cast<const unsigned char *>(request.key.data()), 8));
+        }
+        else if (request.keyType != BIN_KEY_DER)
+        {
+            response.status = BIN_BAD_REQUEST;
+            response.payload = "Missing key";
+            return response;
+        }
+
+        std::vector<unsigned char> data(request.payload.begin(), request.payload.end());
+        std::vector<unsigned char> result;
+        if (request.opcode == BIN_ENCRYPT)
+        {
+            PublicKey pub = key_id.empty()
+                                ? PublicKey::FromDER(reinterpret_cast<const unsigned char *>(request.key.data()), request.key.size())
+                                : find_public_key(key_id);
+            result = pub.Encrypt(data);
+        }
+        else
+        {
+            std::shared_ptr<const PrivateKey> priv = key_id.empty() ? get_private_key(request.key, true) : find_private_key(key_id);
+            result = request.opcode == BIN_SIGN ? priv->Sign(data) : priv->Decrypt(data);
+        }
+        response.payload.assign(result.begin(), result.end());
+    }
+    catch (const KeyNotFound &e)
+    {
+        response.status = BIN_NOT_FOUND;
+        response.payload = e.what();
+    }
+    catch (const InvalidKey &e)
+    {
+        response.status = BIN_BAD_REQUEST;
+        response.payload = e.what();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "[" << current_timestamp() << "] Exception in binary request: " << e.what() << "\n";
+        response.status = BIN_ERROR;
+        response.payload = e.what();
+    }
+    return response;
+}
+
+// Function to read one request from a blocking socket into pooled slabs,
+// until the head and the whole body have arrived or a size limit is hit.
+// The head must fit in the first slab; the body chains further slabs.
+// Returns false when the connection closed first.
+static bool receive_request(int client_socket, HttpRequest &request)
+{
+    BufferChain received(receive_buffers());
+    size_t content_length = 0;
+    size_t body_offset = std::string::npos;
+    while (true)
+    {
+        size_t available;
+        char *space = received.WritableSpace(available);
+        ssize_t bytes_received = recv(client_socket, space, available, 0);
+        if (bytes_received < 0 && errno == EINTR)
+            continue;
+        if (bytes_received <= 0)
+        {
+            if (bytes_received < 0)
+                std::cerr << "[" << current_timestamp() << "] Error receiving data from " << request.peer << "\n";
+            else if (received.Size() == 0)
+                std::cout << "[" << current_timestamp() << "] Connection closed by client " << request.peer << "\n";
+            else
+                std::cerr << "[" << current_timestamp() << "] Incomplete request from " << request.peer << "\n";
+            return false;
+        }
+        received.Commit(bytes_received);
+
+        if (body_offset == std::string::npos)
+        {
+            TraceSpan span("parse_head");
+            std::string head(received.Front(), received.FrontSize());
+            body_offset = parse_request_head(head, request, content_length);
+            if (body_offset != std::string::npos)
+            {
+                std::cout << "[" << current_timestamp() << "] Received request from " << request.peer << "\n";
+                std::cout << head.substr(0, body_offset) << "\n";
+            }
+        }
+        if (!request_within_limits(request, received.Size(), body_offset, content_length))
+            return true;
+        if (body_offset != std::string::npos && received.Size() >= body_offset + content_length)
+        {
+            // One copy into an exactly sized body
+            request.body.reserve(content_length);
+            received.CopyTo(body_offset, content_length, request.body);
+            return true;
+        }
+    }
+}
+
+// Function to wait for a deferred response on the connection's own thread
+static HttpResponse wait_for_response(HttpResponse &deferred)
+{
+    std::promise<HttpResponse> ready;
+    std::future<HttpResponse> response = ready.get_future();
+    deferred.Resume([&ready](HttpResponse result)
+                    { ready.set_value(std::move(result)); });
+    return response.get();
+}
+
+// Function to handle a single client connection (thread-per-connection backend)
+void handle_client(int client_socket, const std::string &peer)
+{
+    std::cout << "[" << current_timestamp() << "] New connection from " << peer << "\n";
+
+    RequestTrace trace;
+    TraceScope trace_scope(&trace);
+
+    HttpRequest request;
+    request.peer = peer;
+    request.fd = client_socket;
+    bool complete;
+    {
+        TraceSpan span("read");
+        complete = receive_request(client_socket, request);
+    }
+    if (!complete)
+    {
         close(client_socket);
         return;
     }
+    trace.SetName(request.method + " " + request.path);
+
+    HttpResponse response;
+    {
+        TraceSpan span("process");
+        response = process_request(request);
+        if (response.IsDeferred())
+            response = wait_for_response(response);
+    }
 
     // Send the response
-    if (!send_response(client_socket, response))
     {
-        std::cerr << "[" << current_timestamp() << "] Failed to send response to " << client_ip << ":" << client_port << "\n";
+        TraceSpan span("send");
+        if (!send_response(client_socket, response))
+        {
+            std::cerr << "[" << current_timestamp() << "] Failed to send response to " << peer << "\n";
+        }
     }
 
-    std::cout << "[" << current_timestamp() << "] Response sent to " << client_ip << ":" << client_port << "\n";
+    std::cout << "[" << current_timestamp() << "] Response sent to " << peer << "\n";
 
     // Close the connection
     close(client_socket);
-    std::cout << "[" << current_timestamp() << "] Connection with " << client_ip << ":" << client_port << " closed.\n";
+    std::cout << "[" << current_timestamp() << "] Connection with " << peer << " closed.\n";
+    trace.Finish(peer);
 }
 
-int main()
+// Function to pin the calling thread to one CPU (Linux only)
+bool pin_current_thread(int cpu)
 {
-    // Define the port number
-    const int PORT = 18080;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
 
+// Function to create a listening socket on the port; every shard binds its
+// own socket and SO_REUSEPORT lets the kernel balance connections across them
+int create_listener(int port)
+{
     // Create a socket
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd == -1)
@@ -587,12 +1734,11 @@ int main()
 
     // Define the server address
     struct sockaddr_in address;
-    int addrlen = sizeof(address);
     memset(&address, 0, sizeof(address));
 
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY; // Listen on all interfaces
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(port);
 
     // Bind the socket to the address
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
@@ -603,19 +1749,74 @@ int main()
     }
 
     // Start listening
-    if (listen(server_fd, 10) < 0)
+    if (listen(server_fd, SOMAXCONN) < 0)
+    {
+        perror("listen failed");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+    return server_fd;
+}
+
+// Function to create a listening Unix domain socket at path with the given
+// permissions, for co-located callers that can skip the TCP/IP stack
+int create_unix_listener(const std::string &path, mode_t mode)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Unix socket path too long: " << path << "\n";
+        exit(EXIT_FAILURE);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd == -1)
+    {
+        perror("socket failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Remove a stale socket left by a previous run
+    unlink(path.c_str());
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror("bind failed");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+    if (chmod(path.c_str(), mode) < 0)
+    {
+        perror("chmod failed");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+    if (listen(server_fd, SOMAXCONN) < 0)
     {
         perror("listen failed");
         close(server_fd);
         exit(EXIT_FAILURE);
     }
+    return server_fd;
+}
+
+// Function to run one shard: accept on its own listener and handle clients.
+// Connection threads inherit the shard's CPU affinity when pinned.
+void accept_loop(int server_fd, int shard, bool pin)
+{
+    if (pin && !pin_current_thread(shard))
+    {
+        std::cerr << "[" << current_timestamp() << "] Could not pin shard " << shard << " to CPU " << shard << "\n";
+    }
 
-    std::cout << "[" << current_timestamp() << "] Server is listening on port " << PORT << "...\n";
+    ShardMetrics &metrics = shard_metrics[shard];
 
     // Accept and handle incoming connections
     while (true)
     {
-        struct sockaddr_in client_addr;
+        struct sockaddr_storage client_addr;
         socklen_t client_addr_len = sizeof(client_addr);
         int client_socket = accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
         if (client_socket < 0)
@@ -624,12 +1825,344 @@ int main()
             continue;
         }
 
+        metrics.accepted++;
+        metrics.active++;
+
         // Handle the client in a separate thread
-        std::thread(handle_client, client_socket, client_addr).detach();
+        std::thread([client_socket, peer = describe_peer(client_addr), &metrics]()
+                    {
+            handle_client(client_socket, peer);
+            metrics.active--; })
+            .detach();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // Define the port number
+    int port = 18080;
+    std::string unix_socket;
+    mode_t unix_socket_mode = 0660;
+    std::string shm_socket;
+
+    int shards = 1;
+    bool pin_shards = false;
+    std::string io_backend = "threads";
+    int io_threads = 2;
+    int keygen_threads = 1;
+    int max_jobs = 64;
+    int job_ttl = 600;
+    int binary_port = 0;
+    double trace_sample_rate = 0;
+    int slow_request_ms = 0;
+    PrimalityPolicy primality;
+    std::vector<int> prime_cache_keysizes;
+    int prime_cache_capacity = 32;
+    int prime_cache_threads = 1;
+    std::string crt_parallel = "adaptive";
+    int crt_helpers = 0;
+    int crt_min_bits = CrtPolicy().minBits;
+
+    // Parse command line options
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--key-store" && i + 1 < argc)
+        {
+            try
+            {
+                key_store.reset(new KeyStore(argv[++i]));
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "[" << current_timestamp() << "] " << e.what() << "\n";
+                exit(EXIT_FAILURE);
+            }
+            std::cout << "[" << current_timestamp() << "] Key store " << argv[i] << " opened with " << key_store->Count() << " keys\n";
+        }
+        else if (arg == "--port" && i + 1 < argc)
+        {
+            port = atoi(argv[++i]);
+        }
+        else if (arg == "--unix-socket" && i + 1 < argc)
+        {
+            unix_socket = argv[++i];
+        }
+        else if (arg == "--shm-socket" && i + 1 < argc)
+        {
+            shm_socket = argv[++i];
+            if (!shm_supported())
+            {
+                std::cerr << "The shared memory transport is not available on this system\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--unix-socket-mode" && i + 1 < argc)
+        {
+            unix_socket_mode = static_cast<mode_t>(strtol(argv[++i], nullptr, 8));
+        }
+        else if (arg == "--shards" && i + 1 < argc)
+        {
+            shards = atoi(argv[++i]);
+        }
+        else if (arg == "--pin")
+        {
+            pin_shards = true;
+        }
+        else if (arg == "--io-backend" && i + 1 < argc)
+        {
+            io_backend = argv[++i];
+            if (io_backend != "threads" && io_backend != "uring" && io_backend != "coro")
+            {
+                std::cerr << "Unknown I/O backend: " << io_backend << "\n";
+                exit(EXIT_FAILURE);
+            }
+            if (io_backend == "uring" && !uring_supported())
+            {
+                std::cerr << "io_uring is not available on this system\n";
+                exit(EXIT_FAILURE);
+            }
+            if (io_backend == "coro" && !coro_supported())
+            {
+                std::cerr << "The coroutine backend is not available on this system\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--io-threads" && i + 1 < argc)
+        {
+            io_threads = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--binary-port" && i + 1 < argc)
+        {
+            binary_port = atoi(argv[++i]);
+        }
+        else if (arg == "--keygen-timeout" && i + 1 < argc)
+        {
+            keygen_timeout_seconds = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--keygen-threads" && i + 1 < argc)
+        {
+            keygen_threads = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--max-jobs" && i + 1 < argc)
+        {
+            max_jobs = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--job-ttl" && i + 1 < argc)
+        {
+            job_ttl = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--max-body-size" && i + 1 < argc)
+        {
+            max_body_size = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--trace-sample-rate" && i + 1 < argc)
+        {
+            trace_sample_rate = atof(argv[++i]);
+        }
+        else if (arg == "--slow-request-ms" && i + 1 < argc)
+        {
+            slow_request_ms = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--primality" && i + 1 < argc)
+        {
+            // bpsw, gmp, or gmp:REPS for mpz_probab_prime_p with REPS repetitions
+            std::string method = argv[++i];
+            if (method == "bpsw")
+            {
+                primality.method = PrimalityPolicy::BailliePSW;
+            }
+            else if (method.compare(0, 3, "gmp") == 0)
+            {
+                primality.method = PrimalityPolicy::Gmp;
+                if (method.size() > 4 && method[3] == ':')
+                    primality.gmpReps = std::max(1, atoi(method.c_str() + 4));
+            }
+            else
+            {
+                std::cerr << "Unknown primality method: " << method << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--prime-cache" && i + 1 < argc)
+        {
+            // Comma-separated key sizes whose primes are harvested ahead of time
+            std::stringstream sizes(argv[++i]);
+            std::string size;
+            while (std::getline(sizes, size, ','))
+            {
+                int keysize = atoi(size.c_str());
+                if (keysize < 512 || keysize % 64 != 0)
+                {
+                    std::cerr << "Invalid prime cache keysize: " << size << "\n";
+                    exit(EXIT_FAILURE);
+                }
+                prime_cache_keysizes.push_back(keysize);
+            }
+        }
+        else if (arg == "--prime-cache-capacity" && i + 1 < argc)
+        {
+            prime_cache_capacity = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--prime-cache-threads" && i + 1 < argc)
+        {
+            prime_cache_threads = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--keygen-seed" && i + 1 < argc)
+        {
+            keygen_seeded = true;
+            keygen_base_seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--crt-parallel" && i + 1 < argc)
+        {
+            // off, on, or adaptive to split CRT halves only under light load
+            crt_parallel = argv[++i];
+            if (crt_parallel != "off" && crt_parallel != "on" && crt_parallel != "adaptive")
+            {
+                std::cerr << "Unknown CRT mode: " << crt_parallel << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--crt-helpers" && i + 1 < argc)
+        {
+            crt_helpers = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--crt-min-bits" && i + 1 < argc)
+        {
+            crt_min_bits = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--mr-rounds" && i + 1 < argc)
+        {
+            std::string rounds = argv[++i];
+            primality.extraRounds = rounds == "fips" ? -1 : std::max(0, atoi(rounds.c_str()));
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--port PORT] [--unix-socket PATH] [--unix-socket-mode OCTAL] [--shm-socket PATH] [--key-store PATH] [--shards N] [--pin] [--io-backend threads|uring|coro] [--io-threads N]"
+                      << " [--binary-port PORT] [--keygen-timeout SECONDS] [--keygen-threads N] [--max-jobs N] [--job-ttl SECONDS] [--max-body-size BYTES]"
+                      << " [--trace-sample-rate FRACTION] [--slow-request-ms MS]"
+                      << " [--primality bpsw|gmp[:REPS]] [--mr-rounds N|fips] [--keygen-seed SEED]"
+                      << " [--prime-cache KEYSIZE,...] [--prime-cache-capacity N] [--prime-cache-threads N]"
+                      << " [--crt-parallel off|on|adaptive] [--crt-helpers N] [--crt-min-bits N]\n";
+            exit(EXIT_FAILURE);
+        }
     }
 
-    // Close the server socket (unreachable in this code)
-    close(server_fd);
+    trace_configure(trace_sample_rate, slow_request_ms);
+    SetPrimalityPolicy(primality);
+
+    // Helpers take the mod-q half of a private-key operation while the
+    // request's own thread computes the mod-p half
+    std::unique_ptr<ThreadPool> crt_pool;
+    CrtPolicy crt;
+    crt.minBits = crt_min_bits;
+    if (crt_parallel != "off")
+    {
+        if (crt_helpers <= 0)
+            crt_helpers = std::max(1u, std::thread::hardware_concurrency() / 2);
+        crt_pool.reset(new ThreadPool(crt_helpers));
+        crt.mode = crt_parallel == "on" ? CrtPolicy::Parallel : CrtPolicy::Adaptive;
+        crt.helpers = crt_pool.get();
+    }
+    SetCrtPolicy(crt);
+
+    // Harvest primes in the background so keys of the listed sizes are
+    // assembled from two cached primes instead of searched per request
+    std::unique_ptr<PrimeCache> prime_cache;
+    if (!prime_cache_keysizes.empty())
+    {
+        std::vector<int> prime_bits;
+        for (int keysize : prime_cache_keysizes)
+            prime_bits.push_back(keysize / 2);
+        prime_cache.reset(new PrimeCache(prime_bits, prime_cache_capacity, prime_cache_threads));
+        SetPrimeCache(prime_cache.get());
+    }
+
+    // Keygen jobs run on their own pool so they never starve request handling
+    keygen_jobs.reset(new KeygenScheduler(generate_key_job, keygen_threads, max_jobs, std::chrono::seconds(job_ttl)));
+
+    // One listener per shard; the default of a single shard keeps the classic
+    // single accept loop, --shards 0 starts one shard per core
+    if (shards <= 0)
+        shards = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> listeners;
+    for (int i = 0; i < shards; i++)
+        listeners.push_back(create_listener(port));
+
+    std::cout << "[" << current_timestamp() << "] Base64 codec: " << Base64Kernel() << " kernel\n";
+    if (primality.method == PrimalityPolicy::Gmp)
+        std::cout << "[" << current_timestamp() << "] Primality: GMP, " << primality.gmpReps << " repetitions\n";
+    else
+        std::cout << "[" << current_timestamp() << "] Primality: Baillie-PSW + "
+                  << (primality.extraRounds < 0 ? std::string("FIPS 186-5") : std::to_string(primality.extraRounds)) << " Miller-Rabin rounds\n";
+    if (crt_pool)
+        std::cout << "[" << current_timestamp() << "] CRT halves: " << (crt.mode == CrtPolicy::Parallel ? "parallel" : "adaptive")
+                  << " on " << crt_helpers << " helper thread(s) for keys of " << crt_min_bits << "+ bits\n";
+    else
+        std::cout << "[" << current_timestamp() << "] CRT halves: serial\n";
+    if (prime_cache)
+        std::cout << "[" << current_timestamp() << "] Prime cache: " << prime_cache_capacity << " primes per size, "
+                  << prime_cache_threads << " harvester thread(s)\n";
+    if (keygen_seeded)
+        std::cerr << "[" << current_timestamp() << "] WARNING: deterministic keygen with seed " << keygen_base_seed
+                  << "; generated keys are predictable, use for benchmarks only\n";
+    std::cout << "[" << current_timestamp() << "] Server is listening on port " << port << " with " << shards << " shard(s)" << (pin_shards ? " (pinned)" : "") << ", " << io_backend << " backend...\n";
+
+    // The Unix socket is one more listener served by the same backend; it is
+    // never pinned since there may be no CPU with its index
+    if (!unix_socket.empty())
+    {
+        listeners.push_back(create_unix_listener(unix_socket, unix_socket_mode));
+        std::cout << "[" << current_timestamp() << "] Listening on Unix socket " << unix_socket << " as shard " << shards << "\n";
+    }
+    shard_metrics.resize(listeners.size());
+
+    // The binary protocol gets its own listener, independent of the HTTP backend
+    if (binary_port > 0)
+    {
+        int binary_fd = create_listener(binary_port);
+        std::thread(binary_accept_loop, binary_fd).detach();
+        std::cout << "[" << current_timestamp() << "] Binary protocol listening on port " << binary_port << "\n";
+    }
+
+    // Shared-memory clients hand over their rings on their own Unix socket
+    if (!shm_socket.empty())
+    {
+        int shm_fd = create_unix_listener(shm_socket, unix_socket_mode);
+        std::thread(shm_accept_loop, shm_fd).detach();
+        std::cout << "[" << current_timestamp() << "] Shared memory transport listening on " << shm_socket << "\n";
+    }
+
+    // The coroutine backend multiplexes every shard over its own I/O threads
+    if (io_backend == "coro")
+    {
+        coro_serve(listeners, io_threads);
+        return 0;
+    }
+
+    auto run_shard = [&](int shard)
+    {
+        bool pin = pin_shards && shard < shards;
+        if (io_backend == "uring")
+        {
+            if (pin && !pin_current_thread(shard))
+                std::cerr << "[" << current_timestamp() << "] Could not pin shard " << shard << " to CPU " << shard << "\n";
+            uring_loop(listeners[shard], shard);
+        }
+        else
+        {
+            accept_loop(listeners[shard], shard, pin);
+        }
+    };
+
+    std::vector<std::thread> shard_threads;
+    for (size_t i = 1; i < listeners.size(); i++)
+        shard_threads.emplace_back(run_shard, i);
+    run_shard(0);
+
+    // Close the server sockets (unreachable in this code)
+    for (int fd : listeners)
+        close(fd);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,61 @@
+// http_server.h
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include "http_response.h"
+#include "thread_pool.h"
+#include "timestamp.h"
+#include <sys/socket.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+
+// A parsed HTTP request, independent of the I/O backend that read it
+struct HttpRequest
+{
+    std::string method;
+    std::string path;
+    std::string http_version;
+    std::map<std::string, std::string> headers;
+    std::string body;
+    std::string peer; // "ip:port", for logging
+    int fd = -1;      // client socket, watched for hangup during long endpoints
+    int reject_status = 0; // 413 or 431 when the reader stopped at a size limit
+};
+
+// Per-shard connection counters, exported by GET /metrics
+struct ShardMetrics
+{
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> active{0};
+};
+extern std::deque<ShardMetrics> shard_metrics;
+
+// Pool that runs endpoint work for the event-driven I/O backends
+ThreadPool &compute_pool();
+
+// Describe an accepted peer for logging ("ip:port" or "unix")
+std::string describe_peer(const sockaddr_storage &addr);
+
+// Parse the request line and headers of a raw request. Returns the offset of
+// the body, or std::string::npos while the header block is incomplete.
+size_t parse_request_head(const std::string &raw, HttpRequest &request, size_t &content_length);
+
+// Largest request body accepted (--max-body-size); larger requests get 413
+extern size_t max_body_size;
+
+// Largest request line plus headers; larger heads get 431
+const size_t MAX_REQUEST_HEAD = 16384;
+
+// Check a request being read against the size limits, given the bytes
+// received so far and the result of parse_request_head. Sets
+// request.reject_status and returns false when reading should stop.
+bool request_within_limits(HttpRequest &request, size_t received, size_t body_offset, size_t content_length);
+
+// Run the endpoint for a complete request and build the HTTP response
+HttpResponse process_request(const HttpRequest &request);
+
+#endif // HTTP_SERVER_H
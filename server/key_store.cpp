@@ -0,0 +1,456 @@
+// key_store.cpp
+#include "key_store.h"
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+static const char DATA_MAGIC[8] = {'R', 'S', 'A', 'K', 'E', 'Y', 'S', '1'};
+static const char INDEX_MAGIC[8] = {'R', 'S', 'A', 'K', 'I', 'D', 'X', '1'};
+static const uint32_t STORE_VERSION = 1;
+static const size_t INITIAL_DATA_SIZE = 1 << 20;
+static const uint64_t INITIAL_INDEX_CAPACITY = 1 << 12;
+
+// Mix a key id into a slot number (ids are random, this guards against weak ones)
+static uint64_t SlotHash(uint64_t id)
+{
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    return id;
+}
+
+static uint64_t RecordSize(const KeyRecordHeader *record)
+{
+    return (sizeof(KeyRecordHeader) + record->pubSize + record->privSize + 7) & ~uint64_t(7);
+}
+
+// Map (or remap) fd with the given size
+static unsigned char *MapFile(int fd, unsigned char *old, size_t oldSize, size_t size)
+{
+    if (old)
+    {
+        munmap(old, oldSize);
+    }
+    if (ftruncate(fd, size) < 0)
+    {
+        throw std::runtime_error(std::string("Key store resize failed: ") + strerror(errno));
+    }
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        throw std::runtime_error(std::string("Key store mmap failed: ") + strerror(errno));
+    }
+    return static_cast<unsigned char *>(addr);
+}
+
+// Map a file read-only at its current size
+static unsigned char *MapFileReadOnly(int fd, size_t size)
+{
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        throw std::runtime_error(std::string("Key store mmap failed: ") + strerror(errno));
+    }
+    return static_cast<unsigned char *>(addr);
+}
+
+static size_t FileSize(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        throw std::runtime_error(std::string("Key store stat failed: ") + strerror(errno));
+    }
+    return st.st_size;
+}
+
+KeyStore::KeyStore(const std::string &path, bool readOnly) : path(path), readOnly(readOnly)
+{
+    // The destructor does not run for a failed open, and a leaked descriptor
+    // would keep the store locked
+    try
+    {
+        Open();
+    }
+    catch (...)
+    {
+        Close();
+        throw;
+    }
+}
+
+KeyStore::~KeyStore()
+{
+    Close();
+}
+
+void KeyStore::Open()
+{
+    dataFd = readOnly ? open(path.c_str(), O_RDONLY) : open(path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (dataFd < 0)
+    {
+        throw std::runtime_error("Cannot open key store " + path + ": " + strerror(errno));
+    }
+    // Two writers would remap and reindex the files under each other
+    if (!readOnly && flock(dataFd, LOCK_EX | LOCK_NB) < 0)
+    {
+        int error = errno;
+        throw std::runtime_error("Key store " + path + " is in use by another process: " + strerror(error));
+    }
+
+    size_t size = FileSize(dataFd);
+    if (readOnly)
+    {
+        if (size < sizeof(KeyStoreHeader))
+        {
+            throw std::runtime_error("Key store " + path + " is truncated");
+        }
+        data = MapFileReadOnly(dataFd, size);
+        dataSize = size;
+    }
+    else if (size == 0)
+    {
+        MapData(INITIAL_DATA_SIZE);
+        KeyStoreHeader *header = reinterpret_cast<KeyStoreHeader *>(data);
+        memcpy(header->magic, DATA_MAGIC, sizeof(DATA_MAGIC));
+        header->version = STORE_VERSION;
+        header->end = sizeof(KeyStoreHeader);
+    }
+    else
+    {
+        if (size < sizeof(KeyStoreHeader))
+        {
+            throw std::runtime_error("Key store " + path + " is truncated");
+        }
+        MapData(size);
+    }
+    if (memcmp(DataHeader()->magic, DATA_MAGIC, sizeof(DATA_MAGIC)) != 0 || DataHeader()->version != STORE_VERSION)
+    {
+        throw std::runtime_error("Key store " + path + " has an unknown format");
+    }
+    // The mapping covers the whole file, so every record must end inside it
+    uint64_t end = DataHeader()->end;
+    if (end < sizeof(KeyStoreHeader) || end > dataSize)
+    {
+        throw std::runtime_error("Key store " + path + " is truncated");
+    }
+    if (readOnly)
+    {
+        openedEnd = end;
+        return;
+    }
+
+    std::string indexPath = path + ".idx";
+    indexFd = open(indexPath.c_str(), O_RDWR | O_CREAT, 0600);
+    if (indexFd < 0)
+    {
+        throw std::runtime_error("Cannot open key index " + indexPath + ": " + strerror(errno));
+    }
+
+    size_t indexFileSize = FileSize(indexFd);
+    bool valid = false;
+    if (indexFileSize >= sizeof(KeyIndexHeader))
+    {
+        MapIndex(indexFileSize);
+        const KeyIndexHeader *header = IndexHeader();
+        valid = memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                header->version == STORE_VERSION &&
+                header->capacity != 0 && (header->capacity & (header->capacity - 1)) == 0 &&
+                header->capacity <= (indexFileSize - sizeof(KeyIndexHeader)) / sizeof(KeyIndexSlot) &&
+                header->count * 2 <= header->capacity &&
+                header->indexedEnd >= sizeof(KeyStoreHeader) && header->indexedEnd <= DataHeader()->end;
+        // Probing relies on free slots, so the count must match the table
+        if (valid)
+        {
+            const KeyIndexSlot *slots = reinterpret_cast<const KeyIndexSlot *>(index + sizeof(KeyIndexHeader));
+            uint64_t used = 0;
+            for (uint64_t i = 0; i < header->capacity; i++)
+                used += slots[i].id != 0;
+            valid = used == header->count;
+        }
+    }
+    if (!valid)
+    {
+        CreateIndex(INITIAL_INDEX_CAPACITY);
+    }
+
+    // Only records appended after the index was last updated need indexing
+    IndexRange(IndexHeader()->indexedEnd, DataHeader()->end);
+}
+
+void KeyStore::Close()
+{
+    if (data)
+    {
+        msync(data, dataSize, MS_SYNC);
+        munmap(data, dataSize);
+        data = nullptr;
+    }
+    if (index)
+    {
+        msync(index, indexSize, MS_SYNC);
+        munmap(index, indexSize);
+        index = nullptr;
+    }
+    if (dataFd >= 0)
+        close(dataFd);
+    if (indexFd >= 0)
+        close(indexFd);
+    dataFd = indexFd = -1;
+}
+
+void KeyStore::MapData(size_t size)
+{
+    data = MapFile(dataFd, data, dataSize, size);
+    dataSize = size;
+}
+
+void KeyStore::MapIndex(size_t size)
+{
+    index = MapFile(indexFd, index, indexSize, size);
+    indexSize = size;
+}
+
+// Start an empty index with the given number of slots
+void KeyStore::CreateIndex(uint64_t capacity)
+{
+    size_t size = sizeof(KeyIndexHeader) + capacity * sizeof(KeyIndexSlot);
+    if (index)
+    {
+        munmap(index, indexSize);
+        index = nullptr;
+    }
+    // Truncating to zero first clears any stale slots
+    if (ftruncate(indexFd, 0) < 0)
+    {
+        throw std::runtime_error(std::string("Key index reset failed: ") + strerror(errno));
+    }
+    MapIndex(size);
+    KeyIndexHeader *header = reinterpret_cast<KeyIndexHeader *>(index);
+    memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header->version = STORE_VERSION;
+    header->capacity = capacity;
+    header->count = 0;
+    header->indexedEnd = sizeof(KeyStoreHeader);
+}
+
+// Index all records stored in [from, to)
+void KeyStore::IndexRange(uint64_t from, uint64_t to)
+{
+    uint64_t offset = from;
+    while (offset < to)
+    {
+        const KeyRecordHeader *record = RecordAt(offset, to);
+        InsertSlot(record->id, offset);
+        offset += RecordSize(record);
+    }
+    reinterpret_cast<KeyIndexHeader *>(index)->indexedEnd = to;
+}
+
+void KeyStore::InsertSlot(uint64_t id, uint64_t offset)
+{
+    // Keep the load factor at or below one half
+    if ((IndexHeader()->count + 1) * 2 > IndexHeader()->capacity)
+    {
+        GrowIndex();
+    }
+
+    KeyIndexHeader *header = reinterpret_cast<KeyIndexHeader *>(index);
+    KeyIndexSlot *slots = reinterpret_cast<KeyIndexSlot *>(index + sizeof(KeyIndexHeader));
+    uint64_t mask = header->capacity - 1;
+    for (uint64_t probe = 0, i = SlotHash(id) & mask; probe < header->capacity; probe++, i = (i + 1) & mask)
+    {
+        if (slots[i].id == 0)
+        {
+            slots[i].offset = offset;
+            slots[i].id = id;
+            header->count++;
+            return;
+        }
+    }
+    throw std::runtime_error("Key index " + path + ".idx is full");
+}
+
+// Double the index and reinsert every slot
+void KeyStore::GrowIndex()
+{
+    const KeyIndexHeader *header = IndexHeader();
+    uint64_t indexedEnd = header->indexedEnd;
+    std::vector<KeyIndexSlot> old(reinterpret_cast<const KeyIndexSlot *>(index + sizeof(KeyIndexHeader)),
+                                  reinterpret_cast<const KeyIndexSlot *>(index + sizeof(KeyIndexHeader)) + header->capacity);
+    CreateIndex(header->capacity * 2);
+    for (const KeyIndexSlot &slot : old)
+    {
+        if (slot.id != 0)
+        {
+            InsertSlot(slot.id, slot.offset);
+        }
+    }
+    reinterpret_cast<KeyIndexHeader *>(index)->indexedEnd = indexedEnd;
+}
+
+// The record at offset, checked to lie whole below end
+const KeyRecordHeader *KeyStore::RecordAt(uint64_t offset, uint64_t end) const
+{
+    if (offset < sizeof(KeyStoreHeader) || offset % 8 != 0 || end - offset < sizeof(KeyRecordHeader))
+    {
+        throw std::runtime_error("Key store " + path + " is corrupt at offset " + std::to_string(offset));
+    }
+    const KeyRecordHeader *record = reinterpret_cast<const KeyRecordHeader *>(data + offset);
+    if (RecordSize(record) > end - offset)
+    {
+        throw std::runtime_error("Key store " + path + " is corrupt at offset " + std::to_string(offset));
+    }
+    return record;
+}
+
+const KeyRecordHeader *KeyStore::FindRecord(uint64_t id) const
+{
+    if (id == 0)
+        return nullptr;
+    if (readOnly)
+    {
+        // No index: scan the records committed at open
+        for (uint64_t offset = sizeof(KeyStoreHeader); offset < openedEnd;)
+        {
+            const KeyRecordHeader *record = RecordAt(offset, openedEnd);
+            if (record->id == id)
+                return record;
+            offset += RecordSize(record);
+        }
+        return nullptr;
+    }
+    const KeyIndexHeader *header = IndexHeader();
+    const KeyIndexSlot *slots = reinterpret_cast<const KeyIndexSlot *>(index + sizeof(KeyIndexHeader));
+    uint64_t mask = header->capacity - 1;
+    for (uint64_t probe = 0, i = SlotHash(id) & mask; probe < header->capacity && slots[i].id != 0;
+         probe++, i = (i + 1) & mask)
+    {
+        if (slots[i].id == id)
+        {
+            // A stale slot may point at another whole record
+            const KeyRecordHeader *record = RecordAt(slots[i].offset, DataHeader()->end);
+            if (record->id != id)
+            {
+                throw std::runtime_error("Key store " + path + " is corrupt at offset " + std::to_string(slots[i].offset));
+            }
+            return record;
+        }
+    }
+    return nullptr;
+}
+
+// Persist a key pair and return its newly assigned id
+uint64_t KeyStore::Append(const PublicKey &pub, const PrivateKey &priv)
+{
+    std::vector<unsigned char> pubDer = pub.ToDER();
+    std::vector<unsigned char> privDer = priv.ToDER();
+    if (readOnly)
+    {
+        throw std::runtime_error("Key store " + path + " is open read-only");
+    }
+
+    static thread_local std::mt19937_64 rng(std::random_device{}());
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    uint64_t id;
+    do
+    {
+        id = rng();
+    } while (id == 0 || FindRecord(id) != nullptr);
+
+    KeyRecordHeader record = {};
+    record.id = id;
+    record.created = std::chrono::duration_cast<std::chrono::seconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    record.keyBits = pub.GetRSAKeySize();
+    record.pubSize = pubDer.size();
+    record.privSize = privDer.size();
+
+    uint64_t offset = DataHeader()->end;
+    uint64_t size = RecordSize(&record);
+    if (offset + size > dataSize)
+    {
+        size_t newSize = dataSize * 2;
+        while (offset + size > newSize)
+            newSize *= 2;
+        MapData(newSize);
+    }
+
+    // Write the record, then publish it by advancing the end offset
+    unsigned char *out = data + offset;
+    memcpy(out, &record, sizeof(record));
+    memcpy(out + sizeof(record), pubDer.data(), pubDer.size());
+    memcpy(out + sizeof(record) + pubDer.size(), privDer.data(), privDer.size());
+    reinterpret_cast<KeyStoreHeader *>(data)->end = offset + size;
+
+    IndexRange(offset, offset + size);
+    return id;
+}
+
+// Look up a key pair by id; either output may be null
+bool KeyStore::Find(uint64_t id, PublicKey *pub, PrivateKey *priv) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    const KeyRecordHeader *record = FindRecord(id);
+    if (!record)
+        return false;
+
+    const unsigned char *der = reinterpret_cast<const unsigned char *>(record) + sizeof(KeyRecordHeader);
+    if (pub)
+        *pub = PublicKey::FromDER(der, record->pubSize);
+    if (priv)
+        *priv = PrivateKey::FromDER(der + record->pubSize, record->privSize);
+    return true;
+}
+
+uint64_t KeyStore::Count() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    if (!readOnly)
+        return IndexHeader()->count;
+    uint64_t count = 0;
+    for (uint64_t offset = sizeof(KeyStoreHeader); offset < openedEnd; count++)
+        offset += RecordSize(RecordAt(offset, openedEnd));
+    return count;
+}
+
+std::string KeyStore::IdToString(uint64_t id)
+{
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(id));
+    return buf;
+}
+
+// Returns 0 when the string is not a valid id
+uint64_t KeyStore::IdFromString(const std::string &text)
+{
+    if (text.empty() || text.length() > 16)
+        return 0;
+    uint64_t id = 0;
+    for (char ch : text)
+    {
+        int value;
+        if (ch >= '0' && ch <= '9')
+            value = ch - '0';
+        else if (ch >= 'a' && ch <= 'f')
+            value = ch - 'a' + 10;
+        else if (ch >= 'A' && ch <= 'F')
+            value = ch - 'A' + 10;
+        else
+            return 0;
+        id = (id << 4) | value;
+    }
+    return id;
+}
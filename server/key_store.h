@@ -0,0 +1,138 @@
+// key_store.h
+#ifndef KEY_STORE_H
+#define KEY_STORE_H
+
+#include "rsa_lib.h"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <shared_mutex>
+#include <mutex>
+
+/*
+  Persistent, append-only key store.
+
+  Two memory-mapped files:
+    <path>      records: a header, then KeyRecordHeader + public DER +
+                private DER, each record padded to 8 bytes
+    <path>.idx  open-addressing hash table of (key id -> record offset)
+
+  Opening maps both files, checks the index's slot count against its
+  header, and only indexes records appended after the index was last
+  written, so startup never decodes the records already indexed.
+  Lookups decode the DER keys straight from the mapping. Every offset read
+  from the files is checked against the committed end before it is
+  followed, so a truncated or corrupt store throws instead of faulting.
+
+  A writer holds an exclusive flock on <path> while the store is open, so
+  only one process appends. A read-only store takes no lock and never
+  touches the index: it sees the records committed when it was opened, and
+  Find and Count scan them, which suits audits of a live store.
+*/
+
+struct KeyStoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t end; // offset one past the last committed record
+};
+
+struct KeyRecordHeader
+{
+    uint64_t id;
+    uint64_t created; // seconds since epoch
+    uint32_t keyBits;
+    uint32_t pubSize;
+    uint32_t privSize;
+    uint32_t reserved;
+};
+
+struct KeyIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;   // number of slots, power of two
+    uint64_t count;      // used slots
+    uint64_t indexedEnd; // data offset covered by the index
+};
+
+struct KeyIndexSlot
+{
+    uint64_t id; // 0 marks an empty slot
+    uint64_t offset;
+};
+
+class KeyStore
+{
+public:
+    // Open (or create) the store at path, or open an existing one read-only;
+    // throws std::runtime_error on failure or when another writer has it open
+    explicit KeyStore(const std::string &path, bool readOnly = false);
+    ~KeyStore();
+
+    KeyStore(const KeyStore &) = delete;
+    KeyStore &operator=(const KeyStore &) = delete;
+
+    // Persist a key pair and return its newly assigned id; not for read-only stores
+    uint64_t Append(const PublicKey &pub, const PrivateKey &priv);
+
+    // Look up a key pair by id; either output may be null
+    bool Find(uint64_t id, PublicKey *pub, PrivateKey *priv) const;
+
+    uint64_t Count() const;
+
+    // Call fn(id, pub) for every stored key in append order
+    template <typename Fn>
+    void ForEach(Fn fn) const;
+
+    static std::string IdToString(uint64_t id);
+    // Returns 0 when the string is not a valid id
+    static uint64_t IdFromString(const std::string &text);
+
+private:
+    void Open();
+    void Close();
+    void MapData(size_t size);
+    void MapIndex(size_t size);
+    void CreateIndex(uint64_t capacity);
+    void IndexRange(uint64_t from, uint64_t to);
+    void InsertSlot(uint64_t id, uint64_t offset);
+    void GrowIndex();
+    const KeyRecordHeader *FindRecord(uint64_t id) const;
+    const KeyRecordHeader *RecordAt(uint64_t offset, uint64_t end) const;
+    uint64_t CommittedEnd() const { return readOnly ? openedEnd : DataHeader()->end; }
+    const KeyStoreHeader *DataHeader() const { return reinterpret_cast<const KeyStoreHeader *>(data); }
+    const KeyIndexHeader *IndexHeader() const { return reinterpret_cast<const KeyIndexHeader *>(index); }
+
+    std::string path;
+    bool readOnly;
+    uint64_t openedEnd = 0; // committed end when a read-only store was opened
+    int dataFd = -1;
+    int indexFd = -1;
+    unsigned char *data = nullptr;
+    size_t dataSize = 0;
+    unsigned char *index = nullptr;
+    size_t indexSize = 0;
+
+    // Appends take the lock exclusively since they may remap the files
+    mutable std::shared_mutex mutex;
+};
+
+template <typename Fn>
+void KeyStore::ForEach(Fn fn) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    uint64_t offset = sizeof(KeyStoreHeader);
+    uint64_t end = CommittedEnd();
+    while (offset < end)
+    {
+        const KeyRecordHeader *record = RecordAt(offset, end);
+        const unsigned char *der = data + offset + sizeof(KeyRecordHeader);
+        fn(record->id, PublicKey::FromDER(der, record->pubSize));
+        offset += (sizeof(KeyRecordHeader) + record->pubSize + record->privSize + 7) & ~uint64_t(7);
+    }
+}
+
+#endif // KEY_STORE_H
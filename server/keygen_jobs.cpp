@@ -0,0 +1,192 @@
+// keygen_jobs.cpp
+#include "keygen_jobs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+const char *KeygenJobStatus::StateName() const
+{
+    switch (state)
+    {
+    case Queued:
+        return "queued";
+    case Running:
+        return "running";
+    case Done:
+        return "done";
+    default:
+        return "failed";
+    }
+}
+
+KeygenScheduler::KeygenScheduler(KeygenFn generate, size_t threads, size_t maxPending, std::chrono::seconds ttl)
+    : generate(std::move(generate)), maxPending(maxPending), ttl(ttl),
+      deadlines(&KeygenScheduler::WatchDeadlines, this), pool(threads)
+{
+}
+
+KeygenScheduler::~KeygenScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    deadlines.join();
+}
+
+std::string KeygenScheduler::Submit(int keysize, const std::string &encoding)
+{
+    std::random_device rd;
+    uint64_t value = (static_cast<uint64_t>(rd()) << 32) | rd();
+    char id[17];
+    snprintf(id, sizeof(id), "%016llx", static_cast<unsigned long long>(value));
+
+    auto job = std::make_shared<Job>();
+    job->status.id = id;
+    job->status.keysize = keysize;
+    job->status.encoding = encoding;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ExpireLocked();
+        if (pending >= maxPending)
+            throw KeygenQueueFull();
+        pending++;
+        jobs[job->status.id] = job;
+    }
+    pool.Submit([this, job]()
+                { Run(job); });
+    return job->status.id;
+}
+
+void KeygenScheduler::Await(const std::string &id, std::chrono::milliseconds wait, JobCallback done)
+{
+    KeygenJobStatus status;
+    bool found;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ExpireLocked();
+        auto it = jobs.find(id);
+        found = it != jobs.end();
+        if (found && !it->second->status.Finished() && wait.count() > 0)
+        {
+            // Hold the job itself so expiry during the wait cannot invalidate it
+            waiters.push_back(Waiter{it->second, std::chrono::steady_clock::now() + wait, std::move(done)});
+            changed.notify_all();
+            return;
+        }
+        if (found)
+            status = it->second->status;
+    }
+    done(found, status);
+}
+
+size_t KeygenScheduler::Pending()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
+
+void KeygenScheduler::Run(std::shared_ptr<Job> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job->status.state = KeygenJobStatus::Running;
+    }
+
+    std::string result;
+    std::string error;
+    try
+    {
+        result = generate(job->status.keysize, job->status.encoding);
+    }
+    catch (const std::exception &e)
+    {
+        error = e.what();
+    }
+
+    // Long-polls on this job are answered outside the lock
+    std::vector<JobCallback> answered;
+    KeygenJobStatus status;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error.empty())
+        {
+            job->status.state = KeygenJobStatus::Done;
+            job->status.result = std::move(result);
+        }
+        else
+        {
+            job->status.state = KeygenJobStatus::Failed;
+            job->status.error = std::move(error);
+        }
+        job->finished = std::chrono::steady_clock::now();
+        pending--;
+        for (auto it = waiters.begin(); it != waiters.end();)
+        {
+            if (it->job == job)
+            {
+                answered.push_back(std::move(it->done));
+                it = waiters.erase(it);
+            }
+            else
+                ++it;
+        }
+        status = job->status;
+    }
+    for (JobCallback &done : answered)
+        done(true, status);
+}
+
+// Deadline thread body: answer long-polls whose wait ran out with the job's
+// unfinished status
+void KeygenScheduler::WatchDeadlines()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto next = std::chrono::steady_clock::time_point::max();
+        std::vector<std::pair<JobCallback, KeygenJobStatus>> expired;
+        for (auto it = waiters.begin(); it != waiters.end();)
+        {
+            if (it->deadline <= now)
+            {
+                expired.emplace_back(std::move(it->done), it->job->status);
+                it = waiters.erase(it);
+            }
+            else
+            {
+                next = std::min(next, it->deadline);
+                ++it;
+            }
+        }
+        if (!expired.empty())
+        {
+            lock.unlock();
+            for (auto &entry : expired)
+                entry.first(true, entry.second);
+            lock.lock();
+            continue;
+        }
+        if (next == std::chrono::steady_clock::time_point::max())
+            changed.wait(lock);
+        else
+            changed.wait_until(lock, next);
+    }
+}
+
+// Drop finished jobs whose results have outlived the ttl
+void KeygenScheduler::ExpireLocked()
+{
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = jobs.begin(); it != jobs.end();)
+    {
+        const Job &job = *it->second;
+        if (job.status.Finished() && now - job.finished > ttl)
+            it = jobs.erase(it);
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,111 @@
+// keygen_jobs.h
+#ifndef KEYGEN_JOBS_H
+#define KEYGEN_JOBS_H
+
+#include "thread_pool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Thrown by KeygenScheduler::Submit when the pending job limit is reached
+struct KeygenQueueFull : std::runtime_error
+{
+    KeygenQueueFull() : std::runtime_error("Too many pending keygen jobs") {}
+};
+
+// Snapshot of one keygen job as returned to clients
+struct KeygenJobStatus
+{
+    enum State
+    {
+        Queued,
+        Running,
+        Done,
+        Failed
+    };
+
+    std::string id;
+    int keysize = 0;
+    std::string encoding; // how the result encodes the keys: "hex", "base64" or "base64url"
+    State state = Queued;
+    std::string result; // JSON body of the finished key pair
+    std::string error;
+
+    bool Finished() const { return state == Done || state == Failed; }
+    const char *StateName() const;
+};
+
+// Runs key generation requests as background jobs on a dedicated pool so
+// slow 4096/8192-bit keys never hold a connection open. At most `threads`
+// jobs generate at once, at most `maxPending` jobs are queued or running,
+// and finished results are dropped `ttl` after completion. Long-polls are
+// answered by callback, so waiting clients hold no thread.
+class KeygenScheduler
+{
+public:
+    // Produces the JSON result for one key of the given size; runs on the pool
+    using KeygenFn = std::function<std::string(int keysize, const std::string &encoding)>;
+    // Receives whether the job is known and, if so, its status
+    using JobCallback = std::function<void(bool found, const KeygenJobStatus &status)>;
+
+    KeygenScheduler(KeygenFn generate, size_t threads, size_t maxPending, std::chrono::seconds ttl);
+    ~KeygenScheduler();
+
+    KeygenScheduler(const KeygenScheduler &) = delete;
+    KeygenScheduler &operator=(const KeygenScheduler &) = delete;
+
+    // Queue a job and return its id; throws KeygenQueueFull when saturated.
+    // Ids are random since a finished job hands out a private key.
+    std::string Submit(int keysize, const std::string &encoding = "hex");
+
+    // Report a job once it finishes or `wait` runs out. `done` runs right away
+    // for an unknown, expired or finished job or a zero wait, and otherwise
+    // later on a keygen worker or the deadline thread; it must not block.
+    void Await(const std::string &id, std::chrono::milliseconds wait, JobCallback done);
+
+    size_t Pending();
+
+private:
+    struct Job
+    {
+        KeygenJobStatus status;
+        std::chrono::steady_clock::time_point finished;
+    };
+
+    // A long-poll waiting for its job
+    struct Waiter
+    {
+        std::shared_ptr<Job> job;
+        std::chrono::steady_clock::time_point deadline;
+        JobCallback done;
+    };
+
+    void Run(std::shared_ptr<Job> job);
+    void WatchDeadlines();
+    void ExpireLocked();
+
+    KeygenFn generate;
+    size_t maxPending;
+    std::chrono::seconds ttl;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<std::string, std::shared_ptr<Job>> jobs;
+    size_t pending = 0;
+    std::vector<Waiter> waiters;
+    bool stopping = false;
+
+    std::thread deadlines; // answers long-polls whose wait ran out
+    ThreadPool pool; // last, so workers stop before the state they use is destroyed
+};
+
+#endif // KEYGEN_JOBS_H
@@ -0,0 +1,282 @@
+// load_gen.cpp
+// Load generator for the RSA REST API: fetches one public key, then issues
+// /encrypt requests from concurrent clients and reports throughput and
+// latency percentiles. With --binary-port the same load is sent as encrypt
+// frames of the binary protocol, one persistent connection per client, and
+// with --shm-socket through the shared-memory transport, one ring per client.
+#include "shm_client.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct LoadGenOptions
+{
+    std::string host = "127.0.0.1";
+    int port = 18080;
+    int connections = 64;
+    int requests = 10000;
+    int keysize = 1024;
+    std::string plaintext = "hello";
+    int binaryPort = 0; // 0 = HTTP
+    std::string shmSocket;
+};
+
+// Send one request on a fresh connection and return the full response ("" on error)
+static std::string http_request(const LoadGenOptions &options, const std::string &path, const std::string &body)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return "";
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.host.c_str(), &address.sin_addr);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        close(fd);
+        return "";
+    }
+
+    std::string request = "POST " + path + " HTTP/1.1\r\n"
+                          "Host: " + options.host + "\r\n"
+                          "Content-Type: application/json\r\n"
+                          "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                          "\r\n" + body;
+    size_t sent = 0;
+    while (sent < request.size())
+    {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            close(fd);
+            return "";
+        }
+        sent += n;
+    }
+
+    // The server closes the connection after each response
+    std::string response;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        response.append(buffer, n);
+    close(fd);
+    return response;
+}
+
+// Open a connection to the given port; -1 on error
+static int connect_to(const LoadGenOptions &options, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, options.host.c_str(), &address.sin_addr);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send one binary protocol frame and read the reply frame; false on error
+static bool binary_call(int fd, const std::string &request, std::string &reply)
+{
+    uint32_t length = htonl(request.size());
+    std::string frame(reinterpret_cast<const char *>(&length), 4);
+    frame += request;
+    if (send(fd, frame.data(), frame.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(frame.size()))
+        return false;
+
+    auto read_full = [fd](char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = recv(fd, data, size, 0);
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    };
+    if (!read_full(reinterpret_cast<char *>(&length), 4))
+        return false;
+    reply.resize(ntohl(length));
+    return reply.empty() || read_full(&reply[0], reply.size());
+}
+
+static std::string json_field(const std::string &text, const std::string &name)
+{
+    size_t pos = text.find("\"" + name + "\"");
+    if (pos == std::string::npos)
+        return "";
+    size_t quote1 = text.find('"', text.find(':', pos));
+    size_t quote2 = text.find('"', quote1 + 1);
+    return text.substr(quote1 + 1, quote2 - quote1 - 1);
+}
+
+int main(int argc, char *argv[])
+{
+    LoadGenOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc)
+            options.host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc)
+            options.port = atoi(argv[++i]);
+        else if (arg == "--connections" && i + 1 < argc)
+            options.connections = std::max(1, atoi(argv[++i]));
+        else if (arg == "--requests" && i + 1 < argc)
+            options.requests = std::max(1, atoi(argv[++i]));
+        else if (arg == "--keysize" && i + 1 < argc)
+            options.keysize = atoi(argv[++i]);
+        else if (arg == "--plaintext" && i + 1 < argc)
+            options.plaintext = argv[++i];
+        else if (arg == "--binary-port" && i + 1 < argc)
+            options.binaryPort = atoi(argv[++i]);
+        else if (arg == "--shm-socket" && i + 1 < argc)
+            options.shmSocket = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--host H] [--port P] [--connections C] [--requests N] [--keysize BITS] [--plaintext TEXT] [--binary-port P] [--shm-socket PATH]\n";
+            return 1;
+        }
+    }
+
+    // HTTP clients send this JSON body; binary clients send an encrypt frame
+    // carrying the raw DER public key
+    std::string body;
+    std::string pub_der;
+    if (!options.shmSocket.empty())
+    {
+        try
+        {
+            ShmClient client(options.shmSocket);
+            std::string bits, reply;
+            for (int shift = 24; shift >= 0; shift -= 8)
+                bits.push_back(static_cast<char>((options.keysize >> shift) & 0xff));
+            if (client.Call(BIN_GENERATE, BIN_KEY_NONE, "", bits, reply) != BIN_OK || reply.size() < 10)
+                throw std::runtime_error(reply);
+            size_t pub_length = (static_cast<unsigned char>(reply[8]) << 8) | static_cast<unsigned char>(reply[9]);
+            pub_der = reply.substr(10, pub_length);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Could not get a public key from " << options.shmSocket << ": " << e.what() << "\n";
+            return 1;
+        }
+    }
+    else if (options.binaryPort > 0)
+    {
+        int fd = connect_to(options, options.binaryPort);
+        uint32_t bits = htonl(options.keysize);
+        std::string reply;
+        // generate frame: opcode 3, no key, u32 key bits
+        std::string generate = std::string("\x03\x00\x00\x00", 4) + std::string(reinterpret_cast<const char *>(&bits), 4);
+        if (fd < 0 || !binary_call(fd, generate, reply) || reply.size() < 11 || reply[0] != 0)
+        {
+            std::cerr << "Could not get a public key from " << options.host << ":" << options.binaryPort << "\n";
+            return 1;
+        }
+        close(fd);
+        size_t pub_length = (static_cast<unsigned char>(reply[9]) << 8) | static_cast<unsigned char>(reply[10]);
+        std::string pub_der = reply.substr(11, pub_length);
+        // encrypt frame: opcode 1, DER key, u16 key length, key, plaintext
+        body = std::string("\x01\x02", 2);
+        body.push_back(static_cast<char>(pub_der.size() >> 8));
+        body.push_back(static_cast<char>(pub_der.size() & 0xff));
+        body += pub_der + options.plaintext;
+    }
+    else
+    {
+        std::string keys = http_request(options, "/generate_keys", "{\"keysize\": " + std::to_string(options.keysize) + "}");
+        std::string public_key = json_field(keys, "public_key");
+        if (public_key.empty())
+        {
+            std::cerr << "Could not get a public key from " << options.host << ":" << options.port << "\n";
+            return 1;
+        }
+        body = "{ \"public_key\": \"" + public_key + "\", \"plaintext\": \"" + options.plaintext + "\" }";
+    }
+
+    std::atomic<int> next{0};
+    std::atomic<int> failures{0};
+    std::vector<std::vector<double>> latencies(options.connections);
+    std::vector<std::thread> clients;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < options.connections; c++)
+    {
+        clients.emplace_back([&, c]()
+                             {
+            int fd = options.binaryPort > 0 ? connect_to(options, options.binaryPort) : -1;
+            std::unique_ptr<ShmClient> shm;
+            if (!options.shmSocket.empty())
+                shm.reset(new ShmClient(options.shmSocket));
+            while (next++ < options.requests)
+            {
+                auto t0 = std::chrono::steady_clock::now();
+                bool ok;
+                if (shm)
+                {
+                    std::string reply;
+                    ok = shm->Call(BIN_ENCRYPT, BIN_KEY_DER, pub_der, options.plaintext, reply) == BIN_OK;
+                }
+                else if (options.binaryPort > 0)
+                {
+                    std::string reply;
+                    ok = fd >= 0 && binary_call(fd, body, reply) && !reply.empty() && reply[0] == 0;
+                }
+                else
+                {
+                    ok = http_request(options, "/encrypt", body).compare(0, 12, "HTTP/1.1 200") == 0;
+                }
+                auto t1 = std::chrono::steady_clock::now();
+                if (!ok)
+                    failures++;
+                latencies[c].push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+            }
+            if (fd >= 0)
+                close(fd); });
+    }
+    for (std::thread &client : clients)
+        client.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (const auto &l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p)
+    { return all.empty() ? 0.0 : all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+
+    std::cout << "requests:    " << all.size() << " (" << failures << " failed)\n"
+              << "connections: " << options.connections << "\n"
+              << "throughput:  " << all.size() / seconds << " req/s\n"
+              << "latency p50: " << percentile(0.50) << " us\n"
+              << "latency p90: " << percentile(0.90) << " us\n"
+              << "latency p99: " << percentile(0.99) << " us\n";
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,138 @@
+// prime_cache.cpp
+#include "prime_cache.h"
+
+#include <algorithm>
+
+bool IsCacheablePrime(const mpz_class &prime, int bits)
+{
+    if (mpz_sizeinbase(prime.get_mpz_t(), 2) != static_cast<size_t>(bits))
+        return false;
+    // 65537 is prime, so it shares a factor with p - 1 only by dividing it
+    return mpz_fdiv_ui(prime.get_mpz_t(), 65537) != 1;
+}
+
+PrimeCache::PrimeCache(const std::vector<int> &primeBits, size_t capacity, size_t threads) : capacity(capacity)
+{
+    for (int bits : primeBits)
+        stocks[bits];
+    for (size_t i = 0; i < threads && !stocks.empty(); i++)
+        harvesters.emplace_back(&PrimeCache::Harvest, this);
+}
+
+PrimeCache::~PrimeCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stop.Cancel();
+    taken.notify_all();
+    for (std::thread &harvester : harvesters)
+        harvester.join();
+}
+
+bool PrimeCache::Take(int bits, mpz_class &prime, const mpz_class *awayFrom)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = stocks.find(bits);
+        if (it == stocks.end())
+            return false;
+        // Primes from one window sit next to each other in the stock
+        std::deque<mpz_class> &stock = it->second;
+        auto found = stock.begin();
+        while (awayFrom && found != stock.end() && !FactorsFarApart(*found, *awayFrom, bits))
+            ++found;
+        if (found == stock.end())
+        {
+            misses++;
+            return false;
+        }
+        prime = std::move(*found);
+        stock.erase(found);
+        hits++;
+    }
+    taken.notify_one();
+    return true;
+}
+
+bool PrimeCache::Put(int bits, const mpz_class &prime)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = stocks.find(bits);
+    if (it == stocks.end() || it->second.size() >= capacity || !IsCacheablePrime(prime, bits))
+        return false;
+    it->second.push_back(prime);
+    return true;
+}
+
+std::vector<int> PrimeCache::PrimeBits() const
+{
+    // The set of sizes never changes after construction
+    std::vector<int> bits;
+    for (const auto &stock : stocks)
+        bits.push_back(stock.first);
+    return bits;
+}
+
+size_t PrimeCache::Stock(int bits)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = stocks.find(bits);
+    return it == stocks.end() ? 0 : it->second.size();
+}
+
+// The size with the emptiest stock, or 0 when every stock is full
+int PrimeCache::NeediestSizeLocked()
+{
+    int neediest = 0;
+    size_t lowest = capacity;
+    for (const auto &stock : stocks)
+    {
+        if (stock.second.size() < lowest)
+        {
+            lowest = stock.second.size();
+            neediest = stock.first;
+        }
+    }
+    return neediest;
+}
+
+// Harvester thread body: harvest windows for the emptiest stock until every
+// stock is full, then sleep until a prime is taken
+void PrimeCache::Harvest()
+{
+    while (true)
+    {
+        int bits;
+        size_t room;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taken.wait(lock, [this, &bits]()
+                       { return stopping || (bits = NeediestSizeLocked()) != 0; });
+            if (stopping)
+                return;
+            room = capacity - stocks[bits].size();
+        }
+
+        // Primes from one window cannot share a key, so one window fills at
+        // most a quarter of the stock. Odd numbers of `bits` bits are prime
+        // with probability about 2 / (bits ln 2), which sizes the window.
+        size_t primes_wanted = std::max<size_t>(1, std::min(room, capacity / 4));
+        size_t window = static_cast<size_t>(primes_wanted * bits * 0.35) + 1;
+        std::vector<mpz_class> primes;
+        try
+        {
+            primes = HarvestPrimes(bits, window, 1, &stop);
+        }
+        catch (const KeygenCancelled &)
+        {
+            return;
+        }
+        for (const mpz_class &prime : primes)
+        {
+            if (Put(bits, prime))
+                harvested++;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+// prime_cache.h
+#ifndef PRIME_CACHE_H
+#define PRIME_CACHE_H
+
+#include "rsa_lib.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Stocks of ready RSA primes per bit size, refilled by background harvester
+// threads that sieve a window at a time and keep every prime in it
+// (HarvestPrimes). Any two primes of a size far enough apart make a key, so
+// one stock serves every request for that key size; CreateRSAKey takes from
+// the cache registered with SetPrimeCache and searches itself on a miss.
+// Stocked primes have exactly their bit size and p - 1 coprime to 65537.
+class PrimeCache
+{
+public:
+    // Keeps up to `capacity` primes of each size in `primeBits`, harvested by `threads` threads
+    PrimeCache(const std::vector<int> &primeBits, size_t capacity, size_t threads);
+    // Stops the harvesters; an unfinished search is abandoned
+    ~PrimeCache();
+
+    PrimeCache(const PrimeCache &) = delete;
+    PrimeCache &operator=(const PrimeCache &) = delete;
+
+    // Take a prime of `bits` bits, skipping primes too close to `awayFrom`
+    // (see FactorsFarApart) when set; false on a miss or a size that is not cached
+    bool Take(int bits, mpz_class &prime, const mpz_class *awayFrom = nullptr);
+    // Hand back or donate a prime; false if its size is not cached or the stock is full
+    bool Put(int bits, const mpz_class &prime);
+
+    std::vector<int> PrimeBits() const;
+    size_t Stock(int bits);
+    size_t Capacity() const { return capacity; }
+    uint64_t Hits() const { return hits; }
+    uint64_t Misses() const { return misses; }
+    uint64_t Harvested() const { return harvested; }
+
+private:
+    void Harvest();
+    int NeediestSizeLocked();
+
+    size_t capacity;
+    std::mutex mutex;
+    std::condition_variable taken;
+    std::map<int, std::deque<mpz_class>> stocks;
+    bool stopping = false;
+    CancellationToken stop; // aborts the harvesters' searches on shutdown
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> harvested{0};
+
+    std::vector<std::thread> harvesters; // last, so they start once the state exists
+};
+
+// Prime that may be stocked for keys with public exponent 65537
+bool IsCacheablePrime(const mpz_class &prime, int bits);
+
+#endif // PRIME_CACHE_H
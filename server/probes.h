@@ -0,0 +1,45 @@
+// probes.h
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes under the "rsa" provider. Each probe is a single nop until perf
+// or bpftrace attaches to it, so they stay in production builds, e.g.
+//
+//   bpftrace -e 'usdt:./RSA_REST_API:rsa:modexp__start { @s[tid] = nsecs; }
+//                usdt:./RSA_REST_API:rsa:modexp__done /@s[tid]/ {
+//                    @us[arg0] = hist((nsecs - @s[tid]) / 1000); delete(@s[tid]); }'
+//
+// Probes:
+//   request__start(method, path)      request__done(path, status)
+//   keygen__candidate(bits)           keygen__prime(bits, candidates tested)
+//   modexp__start(modulus bits)       modexp__done(modulus bits)
+//
+// The probes need <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel);
+// without it, or with RSA_NO_PROBES defined, they compile to nothing.
+
+#if defined(__has_include) && !defined(RSA_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RSA_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef RSA_PROBES_ENABLED
+#define RSA_PROBE1(name, a) DTRACE_PROBE1(rsa, name, a)
+#define RSA_PROBE2(name, a, b) DTRACE_PROBE2(rsa, name, a, b)
+#else
+// Arguments stay referenced (unevaluated) so probe-only values do not warn
+#define RSA_PROBE1(name, a) \
+    do                      \
+    {                       \
+        (void)sizeof(a);    \
+    } while (0)
+#define RSA_PROBE2(name, a, b) \
+    do                         \
+    {                          \
+        (void)sizeof(a);       \
+        (void)sizeof(b);       \
+    } while (0)
+#endif
+
+#endif // PROBES_H
@@ -1,5 +1,10 @@
 // rsa_lib.cpp
 #include "rsa_lib.h"
+#include "base64.h"
+#include "trace.h"
+#include "probes.h"
+#include "prime_cache.h"
+#include "thread_pool.h"
 #include <gmp.h>
 #include <gmpxx.h>
 #include <vector>
@@ -8,7 +13,16 @@
 #include <sstream>
 #include <random>
 #include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <memory>
 #include <thread>
+#include <cstring>
+#include <stdexcept>
 
 /*
   --------------------------------------------------------------------------------
@@ -16,14 +30,281 @@
   --------------------------------------------------------------------------------
 */
 
-// Check if a number is prime using GMP
-bool IsPrime(const mpz_class &n)
+// Active primality policy; read on every test, so kept in atomics
+static std::atomic<int> primality_method{PrimalityPolicy::BailliePSW};
+static std::atomic<int> primality_extra_rounds{-1};
+static std::atomic<int> primality_gmp_reps{25};
+
+void SetPrimalityPolicy(const PrimalityPolicy &policy)
+{
+    primality_method = policy.method;
+    primality_extra_rounds = policy.extraRounds;
+    primality_gmp_reps = std::max(1, policy.gmpReps);
+}
+
+PrimalityPolicy GetPrimalityPolicy()
+{
+    PrimalityPolicy policy;
+    policy.method = static_cast<PrimalityPolicy::Method>(primality_method.load());
+    policy.extraRounds = primality_extra_rounds;
+    policy.gmpReps = primality_gmp_reps;
+    return policy;
+}
+
+// Extra Miller-Rabin rounds after BPSW, after FIPS 186-5 Appendix B.3
+// (Table B.1, rounds followed by one Lucas test) for random candidates.
+// Those rounds keep the probability of accepting a composite below 2^-100
+// (Damgard-Landrock-Pomerance bound), before counting the strength of BPSW
+// itself, which has no known counterexample. Sizes below the table use the
+// conservative count for small probable primes.
+int FipsMillerRabinRounds(int bits)
+{
+    if (bits >= 1536)
+        return 3;
+    if (bits >= 1024)
+        return 4;
+    if (bits >= 512)
+        return 5;
+    return 28;
+}
+
+// Odd primes 3..53, whose product fits in an unsigned long
+static const unsigned TRIAL_PRIMES[] = {3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53};
+static const unsigned long TRIAL_PRIMORIAL = 16294579238595022365UL;
+
+static std::atomic<PrimeCache *> prime_cache{nullptr};
+
+void SetPrimeCache(PrimeCache *cache)
+{
+    prime_cache = cache;
+}
+
+PrimeCache *GetPrimeCache()
+{
+    return prime_cache;
+}
+
+// Generator of the seeded key generation running on this thread, if any
+static thread_local gmp_randclass *seeded_random = nullptr;
+
+// Seed a generator with `bits` bits from the system's entropy source
+static void SeedFromDevice(gmp_randclass &rstate, int bits)
+{
+    std::random_device rd;
+    mpz_class seed = 0;
+    for (int i = 0; i < bits; i += 32)
+        seed = (seed << 32) | rd();
+    rstate.seed(seed);
+}
+
+// Random number generator for Miller-Rabin bases, seeded once per thread
+static gmp_randclass &WitnessRandomState()
+{
+    if (seeded_random)
+        return *seeded_random;
+    thread_local gmp_randclass rstate(gmp_randinit_default);
+    thread_local bool seeded = false;
+    if (!seeded)
+    {
+        SeedFromDevice(rstate, 64);
+        seeded = true;
+    }
+    return rstate;
+}
+
+// Random number generator for prime candidates and harvest windows, seeded
+// once per thread. Every keygen, batch and harvester thread draws from its
+// own stream, so two threads can never sieve the same window.
+static gmp_randclass &CandidateRandomState()
+{
+    thread_local gmp_randclass rstate(gmp_randinit_default);
+    thread_local bool seeded = false;
+    if (!seeded)
+    {
+        SeedFromDevice(rstate, 256);
+        seeded = true;
+    }
+    return rstate;
+}
+
+// Strong probable-prime test to base a for odd n, with n - 1 = d * 2^s
+static bool StrongProbablePrime(const mpz_class &n, const mpz_class &a, const mpz_class &d, unsigned long s)
+{
+    mpz_class nMinusOne = n - 1;
+    mpz_class x;
+    mpz_powm(x.get_mpz_t(), a.get_mpz_t(), d.get_mpz_t(), n.get_mpz_t());
+    if (x == 1 || x == nMinusOne)
+        return true;
+    for (unsigned long r = 1; r < s; r++)
+    {
+        x = x * x % n;
+        if (x == nMinusOne)
+            return true;
+        if (x == 1)
+            return false;
+    }
+    return false;
+}
+
+// Reduce x into [0, n)
+static void ReduceMod(mpz_class &x, const mpz_class &n)
+{
+    mpz_mod(x.get_mpz_t(), x.get_mpz_t(), n.get_mpz_t());
+}
+
+// x / 2 mod n for odd n and x in [0, 2n)
+static void HalveMod(mpz_class &x, const mpz_class &n)
+{
+    ReduceMod(x, n);
+    if (mpz_odd_p(x.get_mpz_t()))
+        x += n;
+    x >>= 1;
+}
+
+// Strong Lucas probable-prime test with Selfridge's parameters: the first D
+// in 5, -7, 9, -11, ... with Jacobi(D/n) = -1, P = 1 and Q = (1 - D) / 4.
+// For odd n > 53 without small factors.
+static bool StrongLucasProbablePrime(const mpz_class &n)
+{
+    // No suitable D exists for a square
+    if (mpz_perfect_square_p(n.get_mpz_t()))
+        return false;
+    long D = 5;
+    while (true)
+    {
+        mpz_class dz = D;
+        int jacobi = mpz_jacobi(dz.get_mpz_t(), n.get_mpz_t());
+        if (jacobi == -1)
+            break;
+        if (jacobi == 0)
+            return false; // gcd(D, n) > 1 and n > |D|
+        D = D > 0 ? -(D + 2) : -D + 2;
+    }
+    long Q = (1 - D) / 4;
+
+    // n + 1 = d * 2^s with d odd
+    mpz_class d = n + 1;
+    unsigned long s = mpz_scan1(d.get_mpz_t(), 0);
+    d >>= s;
+
+    // U_k, V_k and Q^k by left-to-right binary expansion of d, from k = 1
+    mpz_class U = 1, V = 1, Qk = Q;
+    ReduceMod(Qk, n);
+    for (long i = static_cast<long>(mpz_sizeinbase(d.get_mpz_t(), 2)) - 2; i >= 0; i--)
+    {
+        // Doubling: U_2k = U_k V_k, V_2k = V_k^2 - 2 Q^k
+        U = U * V % n;
+        V = V * V - 2 * Qk;
+        ReduceMod(V, n);
+        Qk = Qk * Qk % n;
+        if (mpz_tstbit(d.get_mpz_t(), i))
+        {
+            // Increment with P = 1: U_k+1 = (U_k + V_k) / 2, V_k+1 = (D U_k + V_k) / 2
+            mpz_class nextU = U + V;
+            mpz_class nextV = D * U + V;
+            HalveMod(nextU, n);
+            HalveMod(nextV, n);
+            U = nextU;
+            V = nextV;
+            Qk = Qk * Q;
+            ReduceMod(Qk, n);
+        }
+    }
+    if (U == 0 || V == 0)
+        return true;
+    for (unsigned long r = 1; r < s; r++)
+    {
+        V = V * V - 2 * Qk;
+        ReduceMod(V, n);
+        if (V == 0)
+            return true;
+        Qk = Qk * Qk % n;
+    }
+    return false;
+}
+
+// Check if a number is prime under the active PrimalityPolicy
+bool IsPrime(const mpz_class &n, uint64_t *rounds)
+{
+    uint64_t ran = 0;
+    bool prime = false;
+    if (n < 2)
+    {
+        prime = false;
+    }
+    else if (mpz_even_p(n.get_mpz_t()))
+    {
+        prime = n == 2;
+    }
+    else
+    {
+        // Trial division by the odd primes up to 53 with a single reduction
+        unsigned long residue = mpz_fdiv_ui(n.get_mpz_t(), TRIAL_PRIMORIAL);
+        bool divisible = false;
+        for (unsigned p : TRIAL_PRIMES)
+        {
+            if (residue % p == 0)
+            {
+                divisible = true;
+                prime = n == p;
+                break;
+            }
+        }
+        if (!divisible && n < 59 * 59)
+        {
+            prime = true;
+        }
+        else if (!divisible && primality_method == PrimalityPolicy::Gmp)
+        {
+            // GMP does not report its rounds: a composite fails its first
+            // base-2 round; a probable prime runs Baillie-PSW and reps - 24
+            // more rounds since GMP 6.2, every rep before
+            int reps = primality_gmp_reps;
+            prime = mpz_probab_prime_p(n.get_mpz_t(), reps) > 0;
+#if __GNU_MP_RELEASE >= 60200
+            ran = prime ? 1 + std::max(0, reps - 24) : 1;
+#else
+            ran = prime ? reps : 1;
+#endif
+        }
+        else if (!divisible)
+        {
+            // Baillie-PSW: strong base-2 test, strong Lucas test, then
+            // optional Miller-Rabin rounds with random bases
+            mpz_class d = n - 1;
+            unsigned long s = mpz_scan1(d.get_mpz_t(), 0);
+            d >>= s;
+            ran = 1;
+            prime = StrongProbablePrime(n, 2, d, s) && StrongLucasProbablePrime(n);
+            int extra = primality_extra_rounds;
+            if (extra < 0)
+                extra = FipsMillerRabinRounds(static_cast<int>(mpz_sizeinbase(n.get_mpz_t(), 2)));
+            gmp_randclass *rstate = extra > 0 && prime ? &WitnessRandomState() : nullptr;
+            for (int i = 0; i < extra && prime; i++)
+            {
+                mpz_class base = rstate->get_z_range(n - 3) + 2;
+                prime = StrongProbablePrime(n, base, d, s);
+                ran++;
+            }
+        }
+    }
+    if (rounds)
+        *rounds += ran;
+    return prime;
+}
+
+KeygenStats &KeygenStats::operator+=(const KeygenStats &other)
 {
-    // mpz_probab_prime_p returns:
-    // 0 - composite
-    // 1 - probably prime
-    // 2 - definitely prime
-    return mpz_probab_prime_p(n.get_mpz_t(), 25) > 0;
+    candidates += other.candidates;
+    sieveRejections += other.sieveRejections;
+    primalityTests += other.primalityTests;
+    millerRabinRounds += other.millerRabinRounds;
+    bitSizeRejections += other.bitSizeRejections;
+    equalPrimeRetries += other.equalPrimeRetries;
+    exponentSearches += other.exponentSearches;
+    cachedPrimes += other.cachedPrimes;
+    seconds += other.seconds;
+    return *this;
 }
 
 // Get the next prime number using GMP
@@ -36,104 +317,299 @@ mpz_class GetNextPrime(mpz_class n)
 // Generate a random number of specified bit size
 mpz_class GetRandom(int size)
 {
-    gmp_randclass rstate(gmp_randinit_default);
-    // Seed based on system time
-    unsigned long seed = std::chrono::system_clock::now().time_since_epoch().count();
-    rstate.seed(seed);
+    gmp_randclass &rstate = seeded_random ? *seeded_random : CandidateRandomState();
     mpz_class rand_num = rstate.get_z_bits(size);
     // Ensure the number has the correct bit size and is odd
     rand_num |= (mpz_class(1) << (size - 1)) | 1;
     return rand_num;
 }
 
-// Generate a random prime number of specified bit size
-mpz_class GetRandomPrime(int size, bool verbose, bool debug)
+void CancellationToken::SetDeadline(std::chrono::steady_clock::time_point when)
 {
+    deadline = when.time_since_epoch().count();
+}
+
+bool CancellationToken::IsCancelled() const
+{
+    if (cancelled)
+        return true;
+    std::chrono::steady_clock::rep limit = deadline;
+    return limit != 0 && std::chrono::steady_clock::now().time_since_epoch().count() >= limit;
+}
+
+const char *CancellationToken::Reason() const
+{
+    return cancelled ? "cancelled" : "deadline exceeded";
+}
+
+// Odd primes below this bound are sieved out before a candidate is tested
+const unsigned SMALL_PRIME_BOUND = 2048;
+
+// Odd primes below this bound are sieved out of a harvest window. The window
+// is sieved once for all its candidates, so it affords a far deeper bound.
+const unsigned HARVEST_SIEVE_BOUND = 65536;
+
+// Get the odd primes below bound
+static std::vector<unsigned> OddPrimesBelow(unsigned bound)
+{
+    std::vector<bool> composite(bound, false);
+    std::vector<unsigned> found;
+    for (unsigned i = 3; i < bound; i += 2)
+    {
+        if (composite[i])
+            continue;
+        found.push_back(i);
+        for (unsigned j = i * i; j < bound; j += 2 * i)
+            composite[j] = true;
+    }
+    return found;
+}
+
+// Get the odd primes below SMALL_PRIME_BOUND
+static const std::vector<unsigned> &SmallPrimes()
+{
+    static const std::vector<unsigned> primes = OddPrimesBelow(SMALL_PRIME_BOUND);
+    return primes;
+}
+
+// Generate a random prime number of specified bit size. Like mpz_nextprime it
+// walks odd candidates upwards from a random start, skipping those with a small
+// factor using residues computed once, but it polls the cancellation token
+// before every full primality test.
+mpz_class GetRandomPrime(int size, bool verbose, bool debug, const CancellationToken *cancel, KeygenStats *stats)
+{
+    KeygenStats local;
+    KeygenStats &counts = stats ? *stats : local;
+    const std::vector<unsigned> &primes = SmallPrimes();
+    mpz_class start = GetRandom(size);
+    std::vector<unsigned> residues(primes.size());
+    for (size_t i = 0; i < primes.size(); i++)
+    {
+        residues[i] = mpz_fdiv_ui(start.get_mpz_t(), primes[i]);
+    }
+
     mpz_class prime;
-    while (true)
+    for (unsigned long offset = 0;; offset += 2)
     {
-        prime = GetRandom(size);
-        prime = GetNextPrime(prime);
-        if (IsPrime(prime))
+        counts.candidates++;
+        bool sieved = false;
+        for (size_t i = 0; i < primes.size() && !sieved; i++)
         {
-            if (verbose)
-            {
-                std::cout << "Prime found: " << prime.get_str() << "\n";
-            }
-            break;
+            sieved = (residues[i] + offset) % primes[i] == 0;
         }
-        if (verbose)
+        if (sieved)
+        {
+            counts.sieveRejections++;
+            continue;
+        }
+
+        if (cancel && cancel->IsCancelled())
         {
-            std::cout << "Prime candidate rejected, retrying...\n";
+            throw KeygenCancelled(cancel->Reason());
+        }
+        prime = start + offset;
+        counts.primalityTests++;
+        RSA_PROBE1(keygen__candidate, size);
+        if (IsPrime(prime, &counts.millerRabinRounds))
+        {
+            break;
         }
     }
+    RSA_PROBE2(keygen__prime, size, counts.primalityTests);
+    if (verbose)
+    {
+        std::cout << "Prime found: " << prime.get_str() << "\n";
+    }
     return prime;
 }
 
+// Test the window candidates listed in `survivors`, claiming them one at a
+// time from `next` so several threads share a window
+static void TestHarvestCandidates(const mpz_class &start, const std::vector<uint32_t> &survivors, std::atomic<size_t> &next,
+                                  const CancellationToken *cancel, std::vector<mpz_class> &primes, KeygenStats &stats)
+{
+    mpz_class candidate;
+    for (size_t i = next++; i < survivors.size(); i = next++)
+    {
+        if (cancel && cancel->IsCancelled())
+            return;
+        candidate = start + 2 * static_cast<unsigned long>(survivors[i]);
+        stats.primalityTests++;
+        RSA_PROBE1(keygen__candidate, static_cast<int>(mpz_sizeinbase(start.get_mpz_t(), 2)));
+        if (IsPrime(candidate, &stats.millerRabinRounds))
+            primes.push_back(candidate);
+    }
+}
+
+// Thread body of a parallel harvest; errors are handed back through `error`
+static void HarvestThread(const mpz_class &start, const std::vector<uint32_t> &survivors, std::atomic<size_t> &next,
+                          const CancellationToken *cancel, std::vector<mpz_class> &primes, KeygenStats &stats,
+                          std::exception_ptr &error)
+{
+    try
+    {
+        TestHarvestCandidates(start, survivors, next, cancel, primes, stats);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+}
+
+std::vector<mpz_class> HarvestPrimes(int size, size_t window, unsigned threads, const CancellationToken *cancel,
+                                     KeygenStats *stats)
+{
+    if (size <= 32)
+    {
+        throw std::runtime_error("Harvested primes must have more than 32 bits");
+    }
+    window = std::max<size_t>(1, std::min<size_t>(window, UINT32_MAX));
+    threads = std::max(1u, threads);
+    KeygenStats local;
+    KeygenStats &counts = stats ? *stats : local;
+
+    // Sieve the window start + 2i, i < window: for each small prime, the
+    // first multiple is at i = -start / 2 mod prime, then every prime steps
+    static const std::vector<unsigned> sievePrimes = OddPrimesBelow(HARVEST_SIEVE_BOUND);
+    mpz_class start = GetRandom(size);
+    std::vector<bool> composite(window, false);
+    for (unsigned prime : sievePrimes)
+    {
+        unsigned long residue = mpz_fdiv_ui(start.get_mpz_t(), prime);
+        unsigned long first = (prime - residue) % prime * ((prime + 1) / 2) % prime;
+        for (size_t i = first; i < window; i += prime)
+            composite[i] = true;
+    }
+
+    std::vector<uint32_t> survivors;
+    for (size_t i = 0; i < window; i++)
+    {
+        if (!composite[i])
+            survivors.push_back(static_cast<uint32_t>(i));
+    }
+    counts.candidates += window;
+    counts.sieveRejections += window - survivors.size();
+
+    // The survivors are tested on `threads` threads, this one included
+    std::atomic<size_t> next{0};
+    std::vector<std::vector<mpz_class>> found(threads);
+    std::vector<KeygenStats> threadStats(threads);
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++)
+        workers.emplace_back(HarvestThread, std::cref(start), std::cref(survivors), std::ref(next), cancel,
+                             std::ref(found[t]), std::ref(threadStats[t]), std::ref(errors[t]));
+    HarvestThread(start, survivors, next, cancel, found[0], threadStats[0], errors[0]);
+    for (std::thread &worker : workers)
+        worker.join();
+    for (const std::exception_ptr &error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+    if (cancel && cancel->IsCancelled())
+    {
+        throw KeygenCancelled(cancel->Reason());
+    }
+
+    std::vector<mpz_class> primes;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        counts += threadStats[t];
+        for (mpz_class &prime : found[t])
+        {
+            // The top of the window may run past `size` bits
+            if (mpz_sizeinbase(prime.get_mpz_t(), 2) == static_cast<size_t>(size))
+                primes.push_back(std::move(prime));
+            else
+                counts.bitSizeRejections++;
+        }
+    }
+    std::sort(primes.begin(), primes.end());
+    RSA_PROBE2(keygen__prime, size, counts.primalityTests);
+    return primes;
+}
+
 /*
   --------------------------------------------------------------------------------
   DEFINITIONS OF RSA FUNCTIONS
   --------------------------------------------------------------------------------
 */
 
-// Create RSA keys
-void CreateRSAKey(int keyBitSize, bool verbose, bool debug,
-                  PublicKey &pubKey, PrivateKey &privKey)
+// Makes a seeded generator the source of GetRandom and the Miller-Rabin
+// bases on this thread for the lifetime of the scope (no-op for nullptr)
+class SeededRandomScope
 {
-    if (keyBitSize % 64 != 0)
+public:
+    explicit SeededRandomScope(gmp_randclass *random) : previous(seeded_random)
     {
-        throw std::runtime_error("Number of bits should be a multiple of 64");
+        if (random)
+            seeded_random = random;
     }
+    ~SeededRandomScope() { seeded_random = previous; }
 
-    int pSize = keyBitSize / 2;
-    if (verbose)
-    {
-        std::cout << "Compute RSA keys size: " << keyBitSize << " bits\n";
-    }
+    SeededRandomScope(const SeededRandomScope &) = delete;
+    SeededRandomScope &operator=(const SeededRandomScope &) = delete;
 
-    mpz_class p, q;
+private:
+    gmp_randclass *previous;
+};
 
-    auto generate_prime = [&](mpz_class &prime, const std::string &name)
+// Generate a prime of exactly `bits` bits, drawing from `random` when seeded.
+// A named function rather than a lambda so profiler stacks of the keygen
+// threads stay readable.
+static void GeneratePrimeOfSize(mpz_class &prime, int bits, const char *name, bool verbose, bool debug,
+                                const CancellationToken *cancel, KeygenStats &stats, gmp_randclass *random)
+{
+    SeededRandomScope scope(random);
+    while (true)
     {
-        while (true)
+        prime = GetRandomPrime(bits, verbose, debug, cancel, &stats);
+        if (mpz_sizeinbase(prime.get_mpz_t(), 2) == static_cast<size_t>(bits))
         {
-            prime = GetRandomPrime(pSize, verbose, debug);
-            if (mpz_sizeinbase(prime.get_mpz_t(), 2) == static_cast<size_t>(pSize))
-            {
-                if (verbose)
-                {
-                    std::cout << name << " prime: " << prime.get_str() << "\n";
-                }
-                break;
-            }
             if (verbose)
             {
-                std::cout << "Generated prime does not have correct bit size. Retrying...\n";
+                std::cout << name << " prime: " << prime.get_str() << "\n";
             }
+            break;
         }
-    };
-
-    // Create two threads to generate p and q concurrently
-    std::thread t1([&]()
-                   {
-        generate_prime(p, "p"); });
-    std::thread t2([&]()
-                   {
-        generate_prime(q, "q"); });
-
-    t1.join();
-    t2.join();
-
-    // Ensure p and q are different
-    while (p == q)
-    {
+        stats.bitSizeRejections++;
         if (verbose)
         {
-            std::cout << "p and q are equal, regenerating q...\n";
+            std::cout << "Generated prime does not have correct bit size. Retrying...\n";
         }
-        generate_prime(q, "q");
     }
+}
 
+// Thread body searching one prime factor; errors are handed back through `error`
+static void SearchPrimeThread(mpz_class &prime, int bits, const char *name, bool verbose, bool debug,
+                              const CancellationToken *cancel, KeygenStats &stats, gmp_randclass *random,
+                              std::exception_ptr &error)
+{
+    try
+    {
+        GeneratePrimeOfSize(prime, bits, name, verbose, debug, cancel, stats, random);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+}
+
+// FIPS 186-5 A.1.3 requires |p - q| > 2^(nlen/2 - 100), since n factors
+// quickly by Fermat's method when p and q are both close to sqrt(n)
+bool FactorsFarApart(const mpz_class &p, const mpz_class &q, int bits)
+{
+    mpz_class gap = abs(p - q);
+    if (bits <= 100)
+        return gap != 0;
+    return gap > (mpz_class(1) << (bits - 100));
+}
+
+// Derive the key pair from its two prime factors
+static void AssembleKey(const mpz_class &p, const mpz_class &q, bool verbose, PublicKey &pubKey, PrivateKey &privKey,
+                        KeygenStats &stats)
+{
     mpz_class nn = p * q;
     if (verbose)
     {
@@ -152,6 +628,7 @@ void CreateRSAKey(int keyBitSize, bool verbose, bool debug,
     mpz_gcd(gcd.get_mpz_t(), phi.get_mpz_t(), ee.get_mpz_t());
     while (gcd != 1)
     {
+        stats.exponentSearches++;
         ee = GetNextPrime(ee + 2);
         mpz_gcd(gcd.get_mpz_t(), phi.get_mpz_t(), ee.get_mpz_t());
     }
@@ -175,6 +652,215 @@ void CreateRSAKey(int keyBitSize, bool verbose, bool debug,
     pubKey.ee = ee;
     privKey.nn = nn;
     privKey.dd = dd;
+
+    // Keep the CRT parameters so the private key can be exported as PKCS#1
+    privKey.ee = ee;
+    privKey.pp = p;
+    privKey.qq = q;
+    privKey.dp = dd % (p - 1);
+    privKey.dq = dd % (q - 1);
+    mpz_invert(privKey.qinv.get_mpz_t(), q.get_mpz_t(), p.get_mpz_t());
+}
+
+// Create RSA keys
+KeygenStats CreateRSAKey(int keyBitSize, bool verbose, bool debug,
+                         PublicKey &pubKey, PrivateKey &privKey, const CancellationToken *cancel, const uint64_t *seed)
+{
+    auto started = std::chrono::steady_clock::now();
+    if (keyBitSize % 64 != 0)
+    {
+        throw std::runtime_error("Number of bits should be a multiple of 64");
+    }
+
+    int pSize = keyBitSize / 2;
+    if (verbose)
+    {
+        std::cout << "Compute RSA keys size: " << keyBitSize << " bits\n";
+    }
+
+    mpz_class p, q;
+
+    // A seeded key draws p and q from their own streams, seed * 2 and
+    // seed * 2 + 1, so neither depends on how the threads interleave
+    std::unique_ptr<gmp_randclass> p_random, q_random;
+    if (seed)
+    {
+        mpz_class base = mpz_class(static_cast<unsigned long>(*seed)) << 1;
+        p_random.reset(new gmp_randclass(gmp_randinit_default));
+        p_random->seed(base);
+        q_random.reset(new gmp_randclass(gmp_randinit_default));
+        q_random->seed(base + 1);
+    }
+
+    // Take cached factors when there are any; a missing one is searched here
+    KeygenStats stats;
+    PrimeCache *cache = seed ? nullptr : prime_cache.load();
+    bool p_cached = cache && cache->Take(pSize, p);
+    bool q_cached = p_cached && cache->Take(pSize, q, &p);
+    stats.cachedPrimes = p_cached + q_cached;
+    if (p_cached && !q_cached)
+    {
+        try
+        {
+            GeneratePrimeOfSize(q, pSize, "q", verbose, debug, cancel, stats, nullptr);
+        }
+        catch (...)
+        {
+            cache->Put(pSize, p);
+            throw;
+        }
+    }
+    else if (!p_cached)
+    {
+        // Search p and q on two threads; a cancellation stops both, and the
+        // error is rethrown once they have joined
+        std::exception_ptr p_error, q_error;
+        KeygenStats q_stats;
+        std::thread t1(SearchPrimeThread, std::ref(p), pSize, "p", verbose, debug, cancel, std::ref(stats), p_random.get(), std::ref(p_error));
+        std::thread t2(SearchPrimeThread, std::ref(q), pSize, "q", verbose, debug, cancel, std::ref(q_stats), q_random.get(), std::ref(q_error));
+
+        t1.join();
+        t2.join();
+        stats += q_stats;
+        // A prime found before the other search was cancelled is not wasted
+        if (cache && p_error && !q_error)
+            cache->Put(pSize, q);
+        if (cache && q_error && !p_error)
+            cache->Put(pSize, p);
+        if (p_error)
+            std::rethrow_exception(p_error);
+        if (q_error)
+            std::rethrow_exception(q_error);
+    }
+
+    // Ensure p and q are far apart
+    while (!FactorsFarApart(p, q, pSize))
+    {
+        if (verbose)
+        {
+            std::cout << "p and q are too close, regenerating q...\n";
+        }
+        stats.equalPrimeRetries++;
+        GeneratePrimeOfSize(q, pSize, "q", verbose, debug, cancel, stats, q_random.get());
+    }
+
+    AssembleKey(p, q, verbose, pubKey, privKey, stats);
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return stats;
+}
+
+// Shared state of one CreateRSAKeys call
+struct BatchKeygen
+{
+    size_t count;
+    int primeBits;
+    size_t window;
+    const CancellationToken *cancel;
+    const std::function<void(const PublicKey &, const PrivateKey &, const KeygenStats &)> *onKey;
+
+    std::atomic<size_t> issued{0};
+    std::atomic<bool> failed{false};
+    std::mutex mutex; // serializes onKey and guards totals and error
+    KeygenStats totals;
+    std::exception_ptr error;
+};
+
+// Worker of CreateRSAKeys: harvests windows and pairs each new prime with a
+// spare from an earlier window, since primes of one window are too close to
+// share a key. Each key is charged the work done since this worker's last key.
+static void BatchKeygenThread(BatchKeygen &batch)
+{
+    std::deque<mpz_class> spares;
+    try
+    {
+        KeygenStats stats;
+        auto since = std::chrono::steady_clock::now();
+        while (batch.issued < batch.count && !batch.failed)
+        {
+            std::vector<mpz_class> primes = HarvestPrimes(batch.primeBits, batch.window, 1, batch.cancel, &stats);
+            for (mpz_class &prime : primes)
+            {
+                auto spare = spares.begin();
+                while (spare != spares.end() && !FactorsFarApart(*spare, prime, batch.primeBits))
+                    ++spare;
+                if (spare == spares.end())
+                {
+                    spares.push_back(std::move(prime));
+                    continue;
+                }
+                if (batch.issued++ >= batch.count)
+                {
+                    spares.push_back(std::move(prime));
+                    break;
+                }
+
+                PublicKey pubKey;
+                PrivateKey privKey;
+                AssembleKey(*spare, prime, false, pubKey, privKey, stats);
+                spares.erase(spare);
+                auto now = std::chrono::steady_clock::now();
+                stats.seconds = std::chrono::duration<double>(now - since).count();
+                {
+                    std::lock_guard<std::mutex> lock(batch.mutex);
+                    batch.totals += stats;
+                    (*batch.onKey)(pubKey, privKey, stats);
+                }
+                stats = KeygenStats();
+                since = now;
+            }
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        if (!batch.error)
+            batch.error = std::current_exception();
+        batch.failed = true;
+    }
+
+    // Unpaired primes are still good primes
+    PrimeCache *cache = prime_cache;
+    for (const mpz_class &prime : spares)
+    {
+        if (cache)
+            cache->Put(batch.primeBits, prime);
+    }
+}
+
+KeygenStats CreateRSAKeys(size_t count, int keyBitSize, unsigned threads,
+                          const std::function<void(const PublicKey &, const PrivateKey &, const KeygenStats &)> &onKey,
+                          const CancellationToken *cancel)
+{
+    auto started = std::chrono::steady_clock::now();
+    if (keyBitSize % 64 != 0)
+    {
+        throw std::runtime_error("Number of bits should be a multiple of 64");
+    }
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(1, count)));
+
+    BatchKeygen batch;
+    batch.count = count;
+    batch.primeBits = keyBitSize / 2;
+    // About eight primes per window (see PrimeCache::Harvest for the density)
+    batch.window = static_cast<size_t>(8 * batch.primeBits * 0.35) + 1;
+    batch.cancel = cancel;
+    batch.onKey = &onKey;
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads && count > 0; t++)
+        workers.emplace_back(BatchKeygenThread, std::ref(batch));
+    if (count > 0)
+        BatchKeygenThread(batch);
+    for (std::thread &worker : workers)
+        worker.join();
+    if (batch.error)
+        std::rethrow_exception(batch.error);
+
+    batch.totals.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return batch.totals;
 }
 
 // Encrypt data using the public key
@@ -185,8 +871,12 @@ std::vector<unsigned char> PublicKey::Encrypt(const std::vector<unsigned char> &
     mpz_import(m.get_mpz_t(), data.size(), 1, 1, 0, 0, data.data());
 
     // Encrypt: c = m^e mod n
+    TraceSpan span("rsa.powm");
+    int bits = GetRSAKeySize();
     mpz_class c;
+    RSA_PROBE1(modexp__start, bits);
     mpz_powm(c.get_mpz_t(), m.get_mpz_t(), ee.get_mpz_t(), nn.get_mpz_t());
+    RSA_PROBE1(modexp__done, bits);
 
     // Export encrypted number to bytes
     size_t count;
@@ -207,6 +897,55 @@ std::vector<unsigned char> PublicKey::Encrypt(const std::vector<unsigned char> &
     return encrypted;
 }
 
+// Random number generator used for blinding, seeded once per thread
+static gmp_randclass &BlindingRandomState()
+{
+    thread_local gmp_randclass rstate(gmp_randinit_default);
+    thread_local bool seeded = false;
+    if (!seeded)
+    {
+        SeedFromDevice(rstate, 64);
+        seeded = true;
+    }
+    return rstate;
+}
+
+BlindingCache &BlindingCache::operator=(const BlindingCache &)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uses = 0;
+    modulus = 0;
+    return *this;
+}
+
+// Get a blinding pair valid for (nn, dd) and advance the cached pair
+void BlindingCache::Next(const mpz_class &nn, const mpz_class &dd, mpz_class &outVf, mpz_class &outVi)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (uses == 0 || uses >= BLINDING_REFRESH_INTERVAL || modulus != nn || exponent != dd)
+    {
+        // Full regeneration: vf random and invertible, vi = (vf^-1)^d mod n
+        gmp_randclass &rstate = BlindingRandomState();
+        mpz_class inverse;
+        do
+        {
+            vf = rstate.get_z_range(nn - 2) + 2;
+        } while (!mpz_invert(inverse.get_mpz_t(), vf.get_mpz_t(), nn.get_mpz_t()));
+        mpz_powm(vi.get_mpz_t(), inverse.get_mpz_t(), dd.get_mpz_t(), nn.get_mpz_t());
+        modulus = nn;
+        exponent = dd;
+        uses = 0;
+    }
+
+    outVf = vf;
+    outVi = vi;
+
+    // Cheap refresh for the next caller: (vf^2)^-d = (vf^-d)^2
+    vf = vf * vf % nn;
+    vi = vi * vi % nn;
+    uses++;
+}
+
 // Decrypt data using the private key
 std::vector<unsigned char> PrivateKey::Decrypt(const std::vector<unsigned char> &data) const
 {
@@ -215,8 +954,7 @@ std::vector<unsigned char> PrivateKey::Decrypt(const std::vector<unsigned char>
     mpz_import(c.get_mpz_t(), data.size(), 1, 1, 0, 0, data.data());
 
     // Decrypt: m = c^d mod n
-    mpz_class m;
-    mpz_powm(m.get_mpz_t(), c.get_mpz_t(), dd.get_mpz_t(), nn.get_mpz_t());
+    mpz_class m = Exponentiate(c);
 
     // Export decrypted number to bytes
     size_t count;
@@ -230,6 +968,184 @@ std::vector<unsigned char> PrivateKey::Decrypt(const std::vector<unsigned char>
     return decrypted;
 }
 
+// Active CRT policy; read on every exponentiation, so kept in atomics
+static std::atomic<int> crt_mode{CrtPolicy::Serial};
+static std::atomic<ThreadPool *> crt_helpers{nullptr};
+static std::atomic<int> crt_min_bits{2048};
+static std::atomic<unsigned> crt_max_active{0};
+
+// Exponentiations in flight, the load signal of the Adaptive mode
+static std::atomic<unsigned> active_exponentiations{0};
+
+static std::atomic<uint64_t> crt_full{0};
+static std::atomic<uint64_t> crt_serial{0};
+static std::atomic<uint64_t> crt_parallel{0};
+static std::atomic<uint64_t> crt_reclaimed{0};
+static std::atomic<uint64_t> crt_faults{0};
+
+void SetCrtPolicy(const CrtPolicy &policy)
+{
+    crt_helpers = policy.helpers;
+    crt_min_bits = policy.minBits;
+    crt_max_active = policy.maxActive ? policy.maxActive : std::thread::hardware_concurrency() / 2;
+    crt_mode = policy.helpers ? policy.mode : CrtPolicy::Serial;
+}
+
+CrtCounters GetCrtCounters()
+{
+    CrtCounters counters;
+    counters.full = crt_full;
+    counters.serial = crt_serial;
+    counters.parallel = crt_parallel;
+    counters.reclaimed = crt_reclaimed;
+    counters.faults = crt_faults;
+    return counters;
+}
+
+// One CRT half offered to the helper pool. It owns copies of its inputs, so
+// a helper can still pick it up after the caller has taken it back and left;
+// whoever sets `claimed` first computes it.
+struct CrtHalf
+{
+    mpz_class base;
+    mpz_class exponent;
+    mpz_class modulus;
+    mpz_class result;
+    std::atomic<bool> claimed{false};
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+};
+
+// Whether this exponentiation should hand its mod-q half to the helpers
+static ThreadPool *CrtHelpersFor(int bits, unsigned active)
+{
+    int mode = crt_mode;
+    ThreadPool *helpers = crt_helpers;
+    // Keygen only sets the top bit of each prime, so a 2048-bit key may have a
+    // 2047-bit modulus; compare whole bytes to match the nominal size
+    if (mode == CrtPolicy::Serial || !helpers || (bits + 7) / 8 * 8 < crt_min_bits)
+        return nullptr;
+    if (mode == CrtPolicy::Adaptive && (active > crt_max_active || helpers->QueueDepth() > 0))
+        return nullptr;
+    return helpers;
+}
+
+// c^d mod n from the two half-size exponentiations m1 = c^dp mod p and
+// m2 = c^dq mod q, recombined with Garner's formula m = m2 + q (qinv (m1 - m2) mod p)
+static mpz_class CrtExponentiate(const PrivateKey &key, const mpz_class &c, int bits, unsigned active)
+{
+    mpz_class m1, m2;
+    std::shared_ptr<CrtHalf> half;
+    ThreadPool *helpers = CrtHelpersFor(bits, active);
+    if (helpers)
+    {
+        half = std::make_shared<CrtHalf>();
+        half->base = c % key.qq;
+        half->exponent = key.dq;
+        half->modulus = key.qq;
+        helpers->Submit([half]()
+                        {
+            if (half->claimed.exchange(true))
+                return;
+            mpz_powm(half->result.get_mpz_t(), half->base.get_mpz_t(), half->exponent.get_mpz_t(), half->modulus.get_mpz_t());
+            {
+                std::lock_guard<std::mutex> lock(half->mutex);
+                half->done = true;
+            }
+            half->finished.notify_one(); });
+    }
+
+    mpz_class cp = c % key.pp;
+    mpz_powm(m1.get_mpz_t(), cp.get_mpz_t(), key.dp.get_mpz_t(), key.pp.get_mpz_t());
+
+    if (half && half->claimed.exchange(true))
+    {
+        std::unique_lock<std::mutex> lock(half->mutex);
+        half->finished.wait(lock, [&half]()
+                            { return half->done; });
+        m2 = std::move(half->result);
+        crt_parallel++;
+    }
+    else
+    {
+        mpz_class cq = c % key.qq;
+        mpz_powm(m2.get_mpz_t(), cq.get_mpz_t(), key.dq.get_mpz_t(), key.qq.get_mpz_t());
+        if (half)
+            crt_reclaimed++;
+        else
+            crt_serial++;
+    }
+
+    mpz_class h = (m1 - m2) * key.qinv;
+    mpz_mod(h.get_mpz_t(), h.get_mpz_t(), key.pp.get_mpz_t());
+    return m2 + h * key.qq;
+}
+
+// Compute c^d mod n with a blinded input
+mpz_class PrivateKey::Exponentiate(const mpz_class &c) const
+{
+    // Blind the input so the exponentiation never sees attacker-chosen values
+    mpz_class vf, vi;
+    {
+        TraceSpan span("rsa.blinding");
+        blinding.Next(nn, dd, vf, vi);
+    }
+    mpz_class blinded = c * vf % nn;
+
+    TraceSpan span("rsa.powm");
+    int bits = static_cast<int>(mpz_sizeinbase(nn.get_mpz_t(), 2));
+    unsigned active = ++active_exponentiations;
+    mpz_class m;
+    RSA_PROBE1(modexp__start, bits);
+    bool crt = qinv != 0 && pp != 0 && qq != 0;
+    if (crt)
+    {
+        m = CrtExponentiate(*this, blinded, bits, active);
+        // A fault in one half would leak a factor through gcd(m^e - c, n)
+        // (Bellcore attack), so check the result with the public exponent
+        // and fall back to the full exponent if it is wrong
+        if (ee != 0)
+        {
+            mpz_class check;
+            mpz_powm(check.get_mpz_t(), m.get_mpz_t(), ee.get_mpz_t(), nn.get_mpz_t());
+            if (check != blinded)
+            {
+                crt_faults++;
+                crt = false;
+            }
+        }
+    }
+    if (!crt)
+    {
+        mpz_powm(m.get_mpz_t(), blinded.get_mpz_t(), dd.get_mpz_t(), nn.get_mpz_t());
+        crt_full++;
+    }
+    RSA_PROBE1(modexp__done, bits);
+    active_exponentiations--;
+    return m * vi % nn;
+}
+
+// Sign data with the private key (raw RSA)
+std::vector<unsigned char> PrivateKey::Sign(const std::vector<unsigned char> &data) const
+{
+    mpz_class m;
+    mpz_import(m.get_mpz_t(), data.size(), 1, 1, 0, 0, data.data());
+    if (m >= nn)
+    {
+        throw std::runtime_error("Message too large for the key");
+    }
+
+    mpz_class s = Exponentiate(m);
+
+    // Left-pad to the modulus length so signatures have a fixed size
+    size_t length = (mpz_sizeinbase(nn.get_mpz_t(), 2) + 7) / 8;
+    std::vector<unsigned char> signature(length, 0);
+    size_t count = 0;
+    mpz_export(signature.data() + length - (mpz_sizeinbase(s.get_mpz_t(), 256)), &count, 1, 1, 0, 0, s.get_mpz_t());
+    return signature;
+}
+
 // Convert PublicKey to hexadecimal string
 std::string PublicKey::ToHexa() const
 {
@@ -257,3 +1173,340 @@ int PrivateKey::GetRSAKeySize() const
 {
     return mpz_sizeinbase(nn.get_mpz_t(), 2);
 }
+
+/*
+  --------------------------------------------------------------------------------
+  DEFINITIONS OF KEY SERIALIZATION FUNCTIONS (PKCS#1 DER / PEM)
+  --------------------------------------------------------------------------------
+*/
+
+// Encode bytes as base64, wrapped at 64 characters per line as PEM requires
+static std::string PemBase64Encode(const std::vector<unsigned char> &data)
+{
+    std::string encoded = Base64Encode(data);
+    std::string out;
+    out.reserve(encoded.size() + encoded.size() / 64 + 1);
+    for (size_t i = 0; i < encoded.size(); i += 64)
+    {
+        out.append(encoded, i, 64);
+        out += '\n';
+    }
+    return out;
+}
+
+// Decode PEM base64, skipping whitespace
+static std::vector<unsigned char> PemBase64Decode(const std::string &text)
+{
+    std::string compact;
+    compact.reserve(text.size());
+    for (char ch : text)
+    {
+        if (ch != ' ' && ch != '\n' && ch != '\r' && ch != '\t')
+            compact += ch;
+    }
+    try
+    {
+        return Base64Decode(compact);
+    }
+    catch (const std::exception &)
+    {
+        throw InvalidKey("Invalid character in PEM data");
+    }
+}
+
+// Extract the DER payload of the PEM block with the given label
+static std::vector<unsigned char> PemDecode(const std::string &pem, const std::string &label)
+{
+    std::string begin = "-----BEGIN " + label + "-----";
+    std::string end = "-----END " + label + "-----";
+    size_t start = pem.find(begin);
+    if (start == std::string::npos)
+        throw InvalidKey("Missing PEM header: " + begin);
+    start += begin.length();
+    size_t stop = pem.find(end, start);
+    if (stop == std::string::npos)
+        throw InvalidKey("Missing PEM footer: " + end);
+    return PemBase64Decode(pem.substr(start, stop - start));
+}
+
+static std::string PemEncode(const std::vector<unsigned char> &der, const std::string &label)
+{
+    return "-----BEGIN " + label + "-----\n" + PemBase64Encode(der) + "-----END " + label + "-----\n";
+}
+
+// Number of content bytes of a DER INTEGER holding a non-negative value
+static size_t DerIntegerContentSize(const mpz_class &value)
+{
+    if (value == 0)
+        return 1;
+    size_t bits = mpz_sizeinbase(value.get_mpz_t(), 2);
+    // A leading 0x00 is needed when the top bit of the first byte is set
+    return bits / 8 + 1;
+}
+
+static size_t DerLengthSize(size_t length)
+{
+    size_t size = 1;
+    if (length >= 0x80)
+    {
+        for (size_t l = length; l > 0; l >>= 8)
+            size++;
+    }
+    return size;
+}
+
+static unsigned char *DerWriteLength(unsigned char *out, size_t length)
+{
+    if (length < 0x80)
+    {
+        *out++ = static_cast<unsigned char>(length);
+        return out;
+    }
+    size_t count = DerLengthSize(length) - 1;
+    *out++ = static_cast<unsigned char>(0x80 | count);
+    for (size_t i = count; i > 0; i--)
+        *out++ = static_cast<unsigned char>(length >> (8 * (i - 1)));
+    return out;
+}
+
+// Write the integers as a DER SEQUENCE, exporting limbs straight into the buffer
+static std::vector<unsigned char> DerEncodeSequence(const std::vector<const mpz_class *> &values)
+{
+    size_t contentSize = 0;
+    for (const mpz_class *value : values)
+    {
+        size_t size = DerIntegerContentSize(*value);
+        contentSize += 1 + DerLengthSize(size) + size;
+    }
+
+    std::vector<unsigned char> der(1 + DerLengthSize(contentSize) + contentSize);
+    unsigned char *out = der.data();
+    *out++ = 0x30;
+    out = DerWriteLength(out, contentSize);
+    for (const mpz_class *value : values)
+    {
+        size_t size = DerIntegerContentSize(*value);
+        *out++ = 0x02;
+        out = DerWriteLength(out, size);
+        size_t magnitude = *value == 0 ? 0 : (mpz_sizeinbase(value->get_mpz_t(), 2) + 7) / 8;
+        memset(out, 0, size - magnitude);
+        if (magnitude > 0)
+            mpz_export(out + size - magnitude, nullptr, 1, 1, 0, 0, value->get_mpz_t());
+        out += size;
+    }
+    return der;
+}
+
+// Minimal reader for a DER SEQUENCE of non-negative INTEGERs
+class DerReader
+{
+public:
+    DerReader(const unsigned char *data, size_t size) : cur(data), end(data + size) {}
+
+    // Enter the outer SEQUENCE; returns the total encoded size of it
+    size_t EnterSequence()
+    {
+        const unsigned char *start = cur;
+        size_t length = ReadHeader(0x30);
+        end = cur + length;
+        return cur - start + length;
+    }
+
+    void ReadInteger(mpz_class &value)
+    {
+        size_t length = ReadHeader(0x02);
+        if (length == 0 || (cur[0] & 0x80))
+            throw InvalidKey("Invalid DER integer");
+        mpz_import(value.get_mpz_t(), length, 1, 1, 0, 0, cur);
+        cur += length;
+    }
+
+    bool AtEnd() const { return cur == end; }
+
+private:
+    size_t ReadHeader(unsigned char tag)
+    {
+        if (end - cur < 2 || *cur != tag)
+            throw InvalidKey("Invalid DER encoding");
+        cur++;
+        size_t length = *cur++;
+        if (length & 0x80)
+        {
+            size_t count = length & 0x7f;
+            if (count == 0 || count > sizeof(size_t) || static_cast<size_t>(end - cur) < count)
+                throw InvalidKey("Invalid DER length");
+            length = 0;
+            for (size_t i = 0; i < count; i++)
+                length = (length << 8) | *cur++;
+        }
+        if (length > static_cast<size_t>(end - cur))
+            throw InvalidKey("Truncated DER data");
+        return length;
+    }
+
+    const unsigned char *cur;
+    const unsigned char *end;
+};
+
+// Reject a modulus that no key can have; blinding and exponentiation
+// divide by it, so it must be caught before the key is used
+static void CheckModulus(const mpz_class &nn)
+{
+    if (nn < 3)
+        throw InvalidKey("RSA modulus must be at least 3");
+}
+
+// Split a "n-x" hexa key into its two numbers
+static void ParseHexaPair(const std::string &hexa, mpz_class &first, mpz_class &second)
+{
+    TraceSpan span("rsa.set_str");
+    size_t dash = hexa.find('-');
+    if (dash == std::string::npos ||
+        first.set_str(hexa.substr(0, dash), 16) != 0 ||
+        second.set_str(hexa.substr(dash + 1), 16) != 0)
+    {
+        throw InvalidKey("Invalid key format");
+    }
+}
+
+// Convert PublicKey to PKCS#1 DER
+std::vector<unsigned char> PublicKey::ToDER() const
+{
+    return DerEncodeSequence({&nn, &ee});
+}
+
+// Convert PublicKey to PEM
+std::string PublicKey::ToPEM() const
+{
+    return PemEncode(ToDER(), "RSA PUBLIC KEY");
+}
+
+// Parse PublicKey from "n-e" hexadecimal string
+PublicKey PublicKey::FromHexa(const std::string &hexa)
+{
+    PublicKey key;
+    ParseHexaPair(hexa, key.nn, key.ee);
+    CheckModulus(key.nn);
+    return key;
+}
+
+// Parse PublicKey from PKCS#1 DER
+PublicKey PublicKey::FromDER(const unsigned char *data, size_t size, size_t *consumed)
+{
+    PublicKey key;
+    DerReader reader(data, size);
+    size_t total = reader.EnterSequence();
+    reader.ReadInteger(key.nn);
+    reader.ReadInteger(key.ee);
+    if (!reader.AtEnd())
+        throw InvalidKey("Trailing data in RSA public key");
+    CheckModulus(key.nn);
+    if (consumed)
+        *consumed = total;
+    return key;
+}
+
+// Parse PublicKey from PEM
+PublicKey PublicKey::FromPEM(const std::string &pem)
+{
+    std::vector<unsigned char> der = PemDecode(pem, "RSA PUBLIC KEY");
+    return FromDER(der.data(), der.size());
+}
+
+// Convert PrivateKey to PKCS#1 DER
+std::vector<unsigned char> PrivateKey::ToDER() const
+{
+    if (qinv == 0)
+    {
+        throw std::runtime_error("Private key has no CRT parameters to export");
+    }
+    static const mpz_class version = 0;
+    return DerEncodeSequence({&version, &nn, &ee, &dd, &pp, &qq, &dp, &dq, &qinv});
+}
+
+// Convert PrivateKey to PEM
+std::string PrivateKey::ToPEM() const
+{
+    return PemEncode(ToDER(), "RSA PRIVATE KEY");
+}
+
+// Parse PrivateKey from "n-d" hexadecimal string
+PrivateKey PrivateKey::FromHexa(const std::string &hexa)
+{
+    PrivateKey key;
+    ParseHexaPair(hexa, key.nn, key.dd);
+    CheckModulus(key.nn);
+    return key;
+}
+
+// Factor n from e * d - 1, a multiple of lambda(n) (NIST SP 800-56B,
+// Appendix C): for k = 2^t r with r odd, some g^(r 2^i) is a square root of 1
+// other than +-1 for at least half of all bases g, and it splits n
+bool PrivateKey::RecoverFactors(const mpz_class &e)
+{
+    mpz_class k = e * dd - 1;
+    if (nn < 4 || k <= 0 || mpz_odd_p(k.get_mpz_t()))
+        return false;
+    unsigned long t = mpz_scan1(k.get_mpz_t(), 0);
+    mpz_class r = k >> t;
+    mpz_class nMinusOne = nn - 1;
+    static const unsigned long BASES[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+                                          59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131};
+    for (unsigned long g : BASES)
+    {
+        mpz_class x, y;
+        mpz_powm(x.get_mpz_t(), mpz_class(g).get_mpz_t(), r.get_mpz_t(), nn.get_mpz_t());
+        for (unsigned long i = 0; i < t && x != 1 && x != nMinusOne; i++)
+        {
+            y = x * x % nn;
+            if (y == 1)
+            {
+                // x is a square root of 1 other than +-1, so x - 1 shares
+                // exactly one prime with n. Exponentiate checks every CRT
+                // result against e, so a wrong guess of e cannot go unnoticed.
+                ee = e;
+                mpz_gcd(pp.get_mpz_t(), mpz_class(x - 1).get_mpz_t(), nn.get_mpz_t());
+                qq = nn / pp;
+                dp = dd % (pp - 1);
+                dq = dd % (qq - 1);
+                mpz_invert(qinv.get_mpz_t(), qq.get_mpz_t(), pp.get_mpz_t());
+                return true;
+            }
+            x = y;
+        }
+    }
+    return false;
+}
+
+// Parse PrivateKey from PKCS#1 DER
+PrivateKey PrivateKey::FromDER(const unsigned char *data, size_t size, size_t *consumed)
+{
+    PrivateKey key;
+    mpz_class version;
+    DerReader reader(data, size);
+    size_t total = reader.EnterSequence();
+    reader.ReadInteger(version);
+    if (version != 0)
+        throw InvalidKey("Unsupported RSA private key version");
+    reader.ReadInteger(key.nn);
+    reader.ReadInteger(key.ee);
+    reader.ReadInteger(key.dd);
+    reader.ReadInteger(key.pp);
+    reader.ReadInteger(key.qq);
+    reader.ReadInteger(key.dp);
+    reader.ReadInteger(key.dq);
+    reader.ReadInteger(key.qinv);
+    if (!reader.AtEnd())
+        throw InvalidKey("Trailing data in RSA private key");
+    CheckModulus(key.nn);
+    if (consumed)
+        *consumed = total;
+    return key;
+}
+
+// Parse PrivateKey from PEM
+PrivateKey PrivateKey::FromPEM(const std::string &pem)
+{
+    std::vector<unsigned char> der = PemDecode(pem, "RSA PRIVATE KEY");
+    return FromDER(der.data(), der.size());
+}
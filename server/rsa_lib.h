@@ -5,7 +5,86 @@
 #include <gmpxx.h>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <exception>
+#include <mutex>
+#include <stdexcept>
+
+// Cached blinding pair for a private key. The pair (vf, vi) satisfies
+// vi = vf^-d mod n, so c^d = (c * vf)^d * vi. After each use both values
+// are squared, which keeps the relation and costs two multiplications;
+// a fresh random pair is drawn every BLINDING_REFRESH_INTERVAL uses.
+class BlindingCache
+{
+public:
+    static const int BLINDING_REFRESH_INTERVAL = 32;
+
+    BlindingCache() {}
+    // Copies start with an empty cache so no blinding pair is ever shared
+    BlindingCache(const BlindingCache &) {}
+    BlindingCache &operator=(const BlindingCache &);
+
+    // Get a blinding pair valid for (nn, dd) and advance the cached pair
+    void Next(const mpz_class &nn, const mpz_class &dd, mpz_class &vf, mpz_class &vi);
+
+private:
+    std::mutex mutex;
+    mpz_class modulus;
+    mpz_class exponent;
+    mpz_class vf;
+    mpz_class vi;
+    int uses = 0;
+};
+
+// Cooperative cancellation for key generation. Another thread calls Cancel()
+// (e.g. when the client hangs up) or a deadline passes; the prime search
+// polls IsCancelled() between candidates and throws KeygenCancelled.
+class CancellationToken
+{
+public:
+    void Cancel() { cancelled = true; }
+    void SetDeadline(std::chrono::steady_clock::time_point deadline);
+    bool IsCancelled() const;
+    // Why the token fired: "cancelled" or "deadline exceeded"
+    const char *Reason() const;
+
+private:
+    std::atomic<bool> cancelled{false};
+    std::atomic<std::chrono::steady_clock::rep> deadline{0}; // 0 = none
+};
+
+// Thrown by key generation when its CancellationToken fires
+struct KeygenCancelled : std::runtime_error
+{
+    explicit KeygenCancelled(const char *reason) : std::runtime_error(std::string("Key generation aborted: ") + reason) {}
+};
+
+// Thrown when a key cannot be parsed or is unusable, e.g. a modulus below 3;
+// the caller's input is at fault, not the server
+struct InvalidKey : std::runtime_error
+{
+    explicit InvalidKey(const std::string &what) : std::runtime_error(what) {}
+};
+
+// What one key generation did, returned by CreateRSAKey; explains why some
+// keys take many times longer than others
+struct KeygenStats
+{
+    uint64_t candidates = 0;        // odd candidates walked by the prime searches
+    uint64_t sieveRejections = 0;   // candidates dropped for a small prime factor
+    uint64_t primalityTests = 0;    // full probable-prime tests run
+    uint64_t millerRabinRounds = 0; // Miller-Rabin rounds inside those tests
+    uint64_t bitSizeRejections = 0; // primes discarded for having the wrong size
+    uint64_t equalPrimeRetries = 0; // q regenerated because it was too close to p
+    uint64_t cachedPrimes = 0;      // factors taken from the prime cache
+    uint64_t exponentSearches = 0;  // exponents tried after 65537 shared a factor with phi
+    double seconds = 0;             // wall time
+
+    KeygenStats &operator+=(const KeygenStats &other);
+};
 
 // Define PublicKey and PrivateKey structures
 struct PublicKey {
@@ -15,22 +94,148 @@ struct PublicKey {
     std::vector<unsigned char> Encrypt(const std::vector<unsigned char> &data) const;
     std::string ToHexa() const;
     int GetRSAKeySize() const;
+
+    // PKCS#1 RSAPublicKey encoding (DER, and PEM "RSA PUBLIC KEY")
+    std::vector<unsigned char> ToDER() const;
+    std::string ToPEM() const;
+    static PublicKey FromHexa(const std::string &hexa);
+    // Parse one DER key from data; consumed (if set) receives its length
+    static PublicKey FromDER(const unsigned char *data, size_t size, size_t *consumed = nullptr);
+    static PublicKey FromPEM(const std::string &pem);
 };
 
 struct PrivateKey {
     mpz_class nn;
     mpz_class dd;
+    // Remaining PKCS#1 fields; zero when unknown (e.g. imported from "n-d" hexa)
+    mpz_class ee;
+    mpz_class pp;
+    mpz_class qq;
+    mpz_class dp;
+    mpz_class dq;
+    mpz_class qinv;
+    mutable BlindingCache blinding;
 
     std::vector<unsigned char> Decrypt(const std::vector<unsigned char> &data) const;
+    // Raw RSA signature s = m^d mod n (unpadded, like Encrypt/Decrypt),
+    // returned as a full modulus-length byte string
+    std::vector<unsigned char> Sign(const std::vector<unsigned char> &data) const;
+    // Blinded c^d mod n shared by Decrypt and Sign; uses the CRT when the
+    // key has its factors, with the halves split as the CrtPolicy says
+    mpz_class Exponentiate(const mpz_class &c) const;
     std::string ToHexa() const;
     int GetRSAKeySize() const;
+
+    // PKCS#1 RSAPrivateKey encoding; export requires the CRT fields
+    std::vector<unsigned char> ToDER() const;
+    std::string ToPEM() const;
+    static PrivateKey FromHexa(const std::string &hexa);
+    static PrivateKey FromDER(const unsigned char *data, size_t size, size_t *consumed = nullptr);
+    // Fill in e and the CRT fields of a key known only as (n, d), assuming
+    // public exponent e; false (key unchanged) when n does not factor with it
+    bool RecoverFactors(const mpz_class &e = 65537);
+    static PrivateKey FromPEM(const std::string &pem);
+};
+
+// How IsPrime tests numbers. Baillie-PSW runs trial division, one strong
+// base-2 Miller-Rabin round and a strong Lucas test, then extra Miller-Rabin
+// rounds with random bases; Gmp defers to mpz_probab_prime_p.
+struct PrimalityPolicy
+{
+    enum Method
+    {
+        BailliePSW,
+        Gmp
+    };
+
+    Method method = BailliePSW;
+    int extraRounds = -1; // after BPSW; -1 picks FipsMillerRabinRounds for the size
+    int gmpReps = 25;     // repetitions for the Gmp method
 };
 
+// Process-wide policy used by IsPrime and the prime searches
+void SetPrimalityPolicy(const PrimalityPolicy &policy);
+PrimalityPolicy GetPrimalityPolicy();
+// Extra Miller-Rabin rounds after BPSW for a candidate of the given size
+int FipsMillerRabinRounds(int bits);
+
+class PrimeCache;
+class ThreadPool;
+
+// How PrivateKey::Exponentiate runs its two CRT half exponentiations.
+// Parallel hands the mod-q half to `helpers` while the caller computes the
+// mod-p half; Adaptive does so only while few exponentiations are in flight
+// and the helpers have no backlog, and runs both halves itself otherwise.
+// Either way the caller takes the half back if no helper has started it by
+// the time its own half is done.
+struct CrtPolicy
+{
+    enum Mode
+    {
+        Serial,
+        Parallel,
+        Adaptive
+    };
+
+    Mode mode = Serial;
+    ThreadPool *helpers = nullptr; // needed by Parallel and Adaptive; must outlive every key use
+    int minBits = 2048;            // smaller keys (by nominal size) always run serially
+    unsigned maxActive = 0;        // Adaptive: most exponentiations in flight to split; 0 = half the cores
+};
+
+void SetCrtPolicy(const CrtPolicy &policy);
+
+// How exponentiations ran since startup, for the metrics
+struct CrtCounters
+{
+    uint64_t full = 0;      // no CRT parameters: one full-size exponentiation
+    uint64_t serial = 0;    // both halves on the calling thread
+    uint64_t parallel = 0;  // mod-q half run by a helper
+    uint64_t reclaimed = 0; // handed to the helpers but taken back by the caller
+    uint64_t faults = 0;    // CRT results failing the m^e check, recomputed in full
+};
+
+CrtCounters GetCrtCounters();
+
+// Process-wide prime cache CreateRSAKey takes factors from (nullptr for none);
+// the cache must outlive every key generation
+void SetPrimeCache(PrimeCache *cache);
+PrimeCache *GetPrimeCache();
+
 // RSA utility functions
-bool IsPrime(const mpz_class &n);
+// Check if n is (probably) prime; adds the Miller-Rabin rounds run to *rounds
+bool IsPrime(const mpz_class &n, uint64_t *rounds = nullptr);
 mpz_class GetNextPrime(mpz_class n);
+// Random odd number of exactly `size` bits; drawn from the seeded generator
+// of the current key generation if there is one, else seeded from the clock
 mpz_class GetRandom(int size);
-mpz_class GetRandomPrime(int size, bool verbose, bool debug);
-void CreateRSAKey(int keyBitSize, bool verbose, bool debug, PublicKey &pubKey, PrivateKey &privKey);
+mpz_class GetRandomPrime(int size, bool verbose, bool debug, const CancellationToken *cancel = nullptr,
+                         KeygenStats *stats = nullptr);
+// Sieve a window of `window` consecutive odd numbers from a random `size`-bit
+// start once, test every survivor on `threads` threads and return all the
+// primes of exactly `size` bits found, in ascending order. Amortizes the
+// sieve and the thread start over many primes, for filling prime caches.
+// Primes from one window are close together: never pair two of them in a key.
+std::vector<mpz_class> HarvestPrimes(int size, size_t window, unsigned threads = 1,
+                                     const CancellationToken *cancel = nullptr, KeygenStats *stats = nullptr);
+// Whether p and q of `bits` bits each are far enough apart to share a key
+bool FactorsFarApart(const mpz_class &p, const mpz_class &q, int bits);
+// With a seed, the key and every count in the returned stats depend only on
+// the key size, the seed and the primality policy: p and q come from separate
+// generators derived from the seed, so it does not matter which search thread
+// runs first. Seeded keys are predictable and only meant for benchmarks, and
+// never use the prime cache.
+KeygenStats CreateRSAKey(int keyBitSize, bool verbose, bool debug, PublicKey &pubKey, PrivateKey &privKey,
+                         const CancellationToken *cancel = nullptr, const uint64_t *seed = nullptr);
+// Generate `count` keys on `threads` threads (0 = one per core). Each thread
+// harvests sieve windows (HarvestPrimes) and pairs primes across windows, so
+// the sieve setup is shared by many keys. onKey gets every key as soon as it
+// is assembled, with the work charged to it; calls are serialized but come
+// from the worker threads. Primes left unpaired go to the prime cache.
+// Returns the totals; an exception from onKey or a cancellation stops the
+// workers after their current window and is rethrown.
+KeygenStats CreateRSAKeys(size_t count, int keyBitSize, unsigned threads,
+                          const std::function<void(const PublicKey &, const PrivateKey &, const KeygenStats &)> &onKey,
+                          const CancellationToken *cancel = nullptr);
 
 #endif // RSA_LIB_H
@@ -0,0 +1,167 @@
+// shm_client.cpp
+#include "shm_client.h"
+#include "shm_transport.h"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+// Empty polls of the response ring before the client sleeps
+static const int SHM_CLIENT_SPIN_LIMIT = 2000;
+
+ShmClient::ShmClient(const std::string &socketPath)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Unix socket path too long: " + socketPath);
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        int error = errno;
+        if (sock >= 0)
+            close(sock);
+        throw std::runtime_error("Cannot connect to " + socketPath + ": " + strerror(error));
+    }
+
+    // Receive the handshake with the memfd and the two eventfds
+    ShmHello hello;
+    iovec iov = {&hello, sizeof(hello)};
+    int fds[SHM_FD_COUNT];
+    char control[CMSG_SPACE(sizeof(fds))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (n != sizeof(hello) || memcmp(hello.magic, "RSHM", 4) != 0 || cmsg == nullptr ||
+        cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        close(sock);
+        throw std::runtime_error("Invalid shared memory handshake");
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    requestEvent = fds[SHM_FD_REQUEST_EVENT];
+    responseEvent = fds[SHM_FD_RESPONSE_EVENT];
+
+    size = shm_segment_size(hello.capacity);
+    base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[SHM_FD_MEMORY], 0);
+    close(fds[SHM_FD_MEMORY]);
+    if (base == MAP_FAILED)
+    {
+        base = nullptr;
+        int error = errno;
+        close(requestEvent);
+        close(responseEvent);
+        close(sock);
+        throw std::runtime_error(std::string("Cannot map shared memory: ") + strerror(error));
+    }
+    requests = shm_request_ring(base, hello.capacity);
+    responses = shm_response_ring(base, hello.capacity);
+}
+
+ShmClient::~ShmClient()
+{
+    if (base)
+        munmap(base, size);
+    close(requestEvent);
+    close(responseEvent);
+    close(sock);
+}
+
+// Fail if the server closed the connection
+void ShmClient::WaitForServer()
+{
+    pollfd p = {sock, POLLRDHUP, 0};
+    if (poll(&p, 1, 0) > 0 && (p.revents & (POLLRDHUP | POLLHUP | POLLERR)))
+        throw std::runtime_error("Shared memory server went away");
+}
+
+void ShmClient::Submit(uint8_t opcode, uint8_t keyType, const std::string &key, const std::string &payload)
+{
+    unsigned char head[4] = {opcode, keyType, static_cast<unsigned char>(key.size() >> 8), static_cast<unsigned char>(key.size() & 0xff)};
+    if (key.size() > 0xffff || 4 + key.size() + payload.size() > requests.MaxMessage())
+        throw std::runtime_error("Request too large");
+    iovec iov[3] = {{head, 4},
+                    {const_cast<char *>(key.data()), key.size()},
+                    {const_cast<char *>(payload.data()), payload.size()}};
+    while (!requests.TryPush(iov, 3))
+        WaitForServer();
+    if (requests.NeedsWake())
+    {
+        uint64_t one = 1;
+        if (write(requestEvent, &one, sizeof(one)) != sizeof(one))
+            throw std::runtime_error("Cannot signal the shared memory server");
+    }
+}
+
+uint8_t ShmClient::Receive(std::string &payload)
+{
+    const char *message;
+    size_t length;
+    int idle = 0;
+    while (!responses.Peek(message, length))
+    {
+        if (++idle < SHM_CLIENT_SPIN_LIMIT)
+            continue;
+        idle = 0;
+        if (!responses.PrepareWait())
+            continue;
+        pollfd p[2] = {{responseEvent, POLLIN, 0}, {sock, POLLRDHUP, 0}};
+        poll(p, 2, -1);
+        responses.FinishWait();
+        uint64_t value;
+        if ((p[0].revents & POLLIN) && read(responseEvent, &value, sizeof(value)) < 0)
+            throw std::runtime_error("Cannot wait for the shared memory server");
+        if (p[1].revents & (POLLRDHUP | POLLHUP | POLLERR))
+            throw std::runtime_error("Shared memory server went away");
+    }
+    if (length == 0)
+        throw std::runtime_error("Empty shared memory response");
+    uint8_t status = static_cast<uint8_t>(message[0]);
+    payload.assign(message + 1, length - 1);
+    responses.Release();
+    return status;
+}
+
+uint8_t ShmClient::Call(uint8_t opcode, uint8_t keyType, const std::string &key, const std::string &payload, std::string &result)
+{
+    Submit(opcode, keyType, key, payload);
+    return Receive(result);
+}
+
+// Run one DER-keyed request, turning an error status into an exception
+std::string ShmClient::Checked(uint8_t opcode, const std::string &key, const std::string &payload)
+{
+    std::string result;
+    if (Call(opcode, BIN_KEY_DER, key, payload, result) != BIN_OK)
+        throw std::runtime_error(result);
+    return result;
+}
+
+std::string ShmClient::Encrypt(const std::string &publicDer, const std::string &plaintext)
+{
+    return Checked(BIN_ENCRYPT, publicDer, plaintext);
+}
+
+std::string ShmClient::Decrypt(const std::string &privateDer, const std::string &ciphertext)
+{
+    return Checked(BIN_DECRYPT, privateDer, ciphertext);
+}
+
+std::string ShmClient::Sign(const std::string &privateDer, const std::string &message)
+{
+    return Checked(BIN_SIGN, privateDer, message);
+}
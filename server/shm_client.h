@@ -0,0 +1,52 @@
+// shm_client.h
+#ifndef SHM_CLIENT_H
+#define SHM_CLIENT_H
+
+#include "binary_protocol.h"
+#include "shm_ring.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Client side of the shared-memory transport (see shm_transport.h). Requests
+// are written straight into the shared request ring and responses are read
+// in place from the response ring, so no payload byte goes through the
+// kernel. Requests may be pipelined: responses come back in order.
+// Not thread-safe; use one client per thread.
+class ShmClient
+{
+public:
+    // Connect to the transport's Unix socket; throws std::runtime_error
+    explicit ShmClient(const std::string &socketPath);
+    ~ShmClient();
+
+    ShmClient(const ShmClient &) = delete;
+    ShmClient &operator=(const ShmClient &) = delete;
+
+    // Queue one request; blocks while the request ring is full
+    void Submit(uint8_t opcode, uint8_t keyType, const std::string &key, const std::string &payload);
+    // Wait for the next response; returns its status, payload receives its bytes
+    uint8_t Receive(std::string &payload);
+
+    // Submit and Receive one request
+    uint8_t Call(uint8_t opcode, uint8_t keyType, const std::string &key, const std::string &payload, std::string &result);
+
+    std::string Encrypt(const std::string &publicDer, const std::string &plaintext);
+    std::string Decrypt(const std::string &privateDer, const std::string &ciphertext);
+    std::string Sign(const std::string &privateDer, const std::string &message);
+
+private:
+    std::string Checked(uint8_t opcode, const std::string &key, const std::string &payload);
+    void WaitForServer();
+
+    int sock = -1;
+    int requestEvent = -1;
+    int responseEvent = -1;
+    void *base = nullptr;
+    size_t size = 0;
+    ShmRing requests;
+    ShmRing responses;
+};
+
+#endif // SHM_CLIENT_H
@@ -0,0 +1,175 @@
+// shm_ring.cpp
+#include "shm_ring.h"
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+static const uint32_t WRAP_MARKER = 0xffffffffu;
+static const size_t HEADER_AREA = 4096;
+
+static size_t RecordSize(size_t payload)
+{
+    return (4 + payload + 7) & ~size_t(7);
+}
+
+bool ShmRing::TryPush(const iovec *iov, size_t count)
+{
+    size_t payload = 0;
+    for (size_t i = 0; i < count; i++)
+        payload += iov[i].iov_len;
+    if (payload > MaxMessage())
+        return false;
+
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    size_t offset = tail & (capacity - 1);
+    size_t record = RecordSize(payload);
+    size_t skip = offset + record > capacity ? capacity - offset : 0;
+    if (capacity - (tail - head) < skip + record)
+        return false;
+
+    if (skip > 0)
+    {
+        memcpy(data + offset, &WRAP_MARKER, 4);
+        offset = 0;
+    }
+    uint32_t length = static_cast<uint32_t>(payload);
+    memcpy(data + offset, &length, 4);
+    char *out = data + offset + 4;
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(out, iov[i].iov_base, iov[i].iov_len);
+        out += iov[i].iov_len;
+    }
+    header->tail.store(tail + skip + record, std::memory_order_release);
+    return true;
+}
+
+bool ShmRing::NeedsWake() const
+{
+    // Pairs with the fence in PrepareWait: either the consumer sees the new
+    // tail or the producer sees the waiting flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return header->consumerWaiting.load(std::memory_order_relaxed) != 0;
+}
+
+bool ShmRing::Peek(const char *&message, size_t &size)
+{
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+    if (head == tail)
+        return false;
+    if (tail - head > capacity || (head & 7) != 0)
+        throw std::runtime_error("Corrupt shared memory ring");
+
+    size_t offset = head & (capacity - 1);
+    uint32_t length;
+    memcpy(&length, data + offset, 4);
+    size_t skip = 0;
+    if (length == WRAP_MARKER)
+    {
+        skip = capacity - offset;
+        offset = 0;
+        memcpy(&length, data, 4);
+    }
+    if (length > MaxMessage() || offset + RecordSize(length) > capacity || skip + RecordSize(length) > tail - head)
+        throw std::runtime_error("Corrupt shared memory ring");
+    message = data + offset + 4;
+    size = length;
+    peeked = skip + RecordSize(length);
+    return true;
+}
+
+void ShmRing::Release()
+{
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    header->head.store(head + peeked, std::memory_order_release);
+    peeked = 0;
+}
+
+bool ShmRing::TryPop(std::string &message)
+{
+    const char *data;
+    size_t size;
+    if (!Peek(data, size))
+        return false;
+    message.assign(data, size);
+    Release();
+    return true;
+}
+
+bool ShmRing::PrepareWait()
+{
+    header->consumerWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header->head.load(std::memory_order_relaxed) != header->tail.load(std::memory_order_acquire))
+    {
+        FinishWait();
+        return false;
+    }
+    return true;
+}
+
+void ShmRing::FinishWait()
+{
+    header->consumerWaiting.store(0, std::memory_order_relaxed);
+}
+
+size_t shm_segment_size(uint32_t capacity)
+{
+    return 2 * (HEADER_AREA + capacity);
+}
+
+void shm_init_segment(void *base, uint32_t capacity)
+{
+    char *bytes = static_cast<char *>(base);
+    for (size_t ring = 0; ring < 2; ring++)
+    {
+        ShmRingHeader *header = new (bytes + ring * (HEADER_AREA + capacity)) ShmRingHeader;
+        header->tail.store(0);
+        header->head.store(0);
+        header->consumerWaiting.store(0);
+        header->capacity = capacity;
+    }
+}
+
+#ifdef __linux__
+int shm_create_segment(uint32_t capacity)
+{
+    int fd = memfd_create("rsa-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+    // Sealed at its final size: a peer holding the descriptor can no longer
+    // truncate it under our mapping and turn the next ring access into SIGBUS
+    if (ftruncate(fd, shm_segment_size(capacity)) != 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+ShmRing shm_request_ring(void *base, uint32_t capacity)
+{
+    char *bytes = static_cast<char *>(base);
+    return ShmRing(reinterpret_cast<ShmRingHeader *>(bytes), bytes + HEADER_AREA, capacity);
+}
+
+ShmRing shm_response_ring(void *base, uint32_t capacity)
+{
+    char *bytes = static_cast<char *>(base) + HEADER_AREA + capacity;
+    return ShmRing(reinterpret_cast<ShmRingHeader *>(bytes), bytes + HEADER_AREA, capacity);
+}
@@ -0,0 +1,84 @@
+// shm_ring.h
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <sys/uio.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+  Single-producer/single-consumer byte ring living in a shared memory
+  segment. Messages are stored as a u32 length followed by the bytes,
+  padded to 8 bytes; a message that would straddle the end of the data
+  area is preceded by a wrap marker and starts again at offset 0.
+
+  head and tail are free-running byte counters on separate cache lines.
+  The consumer raises consumerWaiting before it sleeps on its eventfd and
+  the producer only signals the eventfd when the flag is set, so a busy
+  ring exchanges messages without any system call.
+*/
+
+const size_t SHM_CACHE_LINE = 64;
+
+// Default data area per ring; must be a power of two
+const uint32_t SHM_RING_CAPACITY = 4u << 20;
+
+struct ShmRingHeader
+{
+    alignas(SHM_CACHE_LINE) std::atomic<uint64_t> tail; // bytes published by the producer
+    alignas(SHM_CACHE_LINE) std::atomic<uint64_t> head; // bytes released by the consumer
+    alignas(SHM_CACHE_LINE) std::atomic<uint32_t> consumerWaiting;
+    uint32_t capacity;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory rings need lock-free 64-bit atomics");
+
+class ShmRing
+{
+public:
+    ShmRing() {}
+    // capacity is kept privately: the peer can scribble over the shared header
+    ShmRing(ShmRingHeader *header, char *data, uint32_t capacity) : header(header), data(data), capacity(capacity) {}
+
+    // Largest message a ring of this capacity accepts
+    size_t MaxMessage() const { return capacity / 2 - 8; }
+
+    // Producer: copy the pieces in as one message; false when there is no room yet
+    bool TryPush(const iovec *iov, size_t count);
+    // Producer: true when the consumer is asleep and must be woken
+    bool NeedsWake() const;
+
+    // Consumer: view the oldest message in place; false when the ring is empty.
+    // Throws std::runtime_error when the peer corrupted the ring.
+    bool Peek(const char *&message, size_t &size);
+    // Consumer: release the message returned by Peek
+    void Release();
+    bool TryPop(std::string &message);
+
+    // Consumer: announce a sleep; returns false (and clears the flag) if a
+    // message arrived meanwhile, so the caller must not sleep
+    bool PrepareWait();
+    void FinishWait();
+
+private:
+    ShmRingHeader *header = nullptr;
+    char *data = nullptr;
+    uint64_t capacity = 0;
+    uint64_t peeked = 0; // bytes Release will free
+};
+
+// A shared segment holds the request ring (client -> server) followed by the
+// response ring (server -> client), each header on its own page
+size_t shm_segment_size(uint32_t capacity);
+void shm_init_segment(void *base, uint32_t capacity);
+#ifdef __linux__
+// memfd of shm_segment_size(capacity) bytes, sealed against resizing so it
+// can be handed to an untrusted peer; -1 with errno set on failure
+int shm_create_segment(uint32_t capacity);
+#endif
+ShmRing shm_request_ring(void *base, uint32_t capacity);
+ShmRing shm_response_ring(void *base, uint32_t capacity);
+
+#endif // SHM_RING_H
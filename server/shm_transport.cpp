@@ -0,0 +1,203 @@
+// shm_transport.cpp
+#include "shm_transport.h"
+#include "binary_protocol.h"
+#include "http_server.h"
+#include "shm_ring.h"
+
+#include <iostream>
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+// Empty polls of the request ring before the server thread sleeps
+static const int SHM_SPIN_LIMIT = 2000;
+
+// Send the handshake and the ring descriptors over the Unix socket
+static bool send_hello(int sock, uint32_t capacity, const int (&fds)[SHM_FD_COUNT])
+{
+    ShmHello hello;
+    memcpy(hello.magic, "RSHM", 4);
+    hello.capacity = capacity;
+    iovec iov = {&hello, sizeof(hello)};
+
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(hello));
+}
+
+// True once the client closed its end of the socket
+static bool client_gone(int sock, int timeout_ms)
+{
+    pollfd p = {sock, POLLRDHUP, 0};
+    return poll(&p, 1, timeout_ms) > 0 && (p.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+// Serve one client's request ring until it disconnects
+static void serve_shm_client(int sock)
+{
+    const uint32_t capacity = SHM_RING_CAPACITY;
+    size_t size = shm_segment_size(capacity);
+    int fds[SHM_FD_COUNT] = {
+        shm_create_segment(capacity),
+        eventfd(0, EFD_CLOEXEC),
+        eventfd(0, EFD_CLOEXEC),
+    };
+    void *base = MAP_FAILED;
+    if (fds[SHM_FD_MEMORY] >= 0)
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[SHM_FD_MEMORY], 0);
+
+    uint64_t served = 0;
+    if (base == MAP_FAILED || fds[SHM_FD_REQUEST_EVENT] < 0 || fds[SHM_FD_RESPONSE_EVENT] < 0)
+    {
+        std::cerr << "[" << current_timestamp() << "] Shared memory setup failed: " << strerror(errno) << "\n";
+    }
+    else
+    {
+        shm_init_segment(base, capacity);
+        ShmRing requests = shm_request_ring(base, capacity);
+        ShmRing responses = shm_response_ring(base, capacity);
+        bool connected = send_hello(sock, capacity, fds);
+        int idle = 0;
+
+        while (connected)
+        {
+            const char *message;
+            size_t length;
+            bool ready;
+            try
+            {
+                ready = requests.Peek(message, length);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "[" << current_timestamp() << "] Dropping shared memory client: " << e.what() << "\n";
+                break;
+            }
+
+            if (!ready)
+            {
+                // Spin briefly so a busy client never pays for a wakeup
+                if (++idle < SHM_SPIN_LIMIT)
+                    continue;
+                idle = 0;
+                if (requests.PrepareWait())
+                {
+                    pollfd p[2] = {{fds[SHM_FD_REQUEST_EVENT], POLLIN, 0}, {sock, POLLRDHUP, 0}};
+                    poll(p, 2, -1);
+                    requests.FinishWait();
+                    uint64_t value;
+                    if (p[0].revents & POLLIN)
+                        connected = read(fds[SHM_FD_REQUEST_EVENT], &value, sizeof(value)) == sizeof(value);
+                    if (p[1].revents & (POLLRDHUP | POLLHUP | POLLERR))
+                        connected = false;
+                }
+                continue;
+            }
+            idle = 0;
+
+            BinaryRequest request;
+            BinaryResponse response;
+            bool parsed = parse_binary_request(std::string(message, length), request);
+            requests.Release();
+            if (parsed)
+            {
+                response = process_binary_request(request);
+            }
+            else
+            {
+                response.status = BIN_BAD_REQUEST;
+                response.payload = "Malformed frame";
+            }
+            if (1 + response.payload.size() > responses.MaxMessage())
+            {
+                response.status = BIN_ERROR;
+                response.payload = "Response too large";
+            }
+
+            // The client drains responses; if it stops, wait until it leaves
+            iovec iov[2] = {{&response.status, 1}, {&response.payload[0], response.payload.size()}};
+            while (!responses.TryPush(iov, 2))
+            {
+                if (client_gone(sock, 1))
+                {
+                    connected = false;
+                    break;
+                }
+            }
+            if (connected && responses.NeedsWake())
+            {
+                uint64_t one = 1;
+                connected = write(fds[SHM_FD_RESPONSE_EVENT], &one, sizeof(one)) == sizeof(one);
+            }
+            served++;
+        }
+        munmap(base, size);
+    }
+
+    for (int fd : fds)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+    close(sock);
+    std::cout << "[" << current_timestamp() << "] Shared memory client closed after " << served << " requests\n";
+}
+
+bool shm_supported()
+{
+    return true;
+}
+
+void shm_accept_loop(int server_fd)
+{
+    while (true)
+    {
+        int client_socket = accept4(server_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_socket < 0)
+        {
+            perror("accept failed");
+            continue;
+        }
+        std::cout << "[" << current_timestamp() << "] New shared memory client\n";
+        std::thread(serve_shm_client, client_socket).detach();
+    }
+}
+
+#else // !__linux__
+
+#include <cstdlib>
+
+bool shm_supported()
+{
+    return false;
+}
+
+void shm_accept_loop(int)
+{
+    std::cerr << "shared memory transport needs memfd and eventfd and is not available on this platform\n";
+    std::abort();
+}
+
+#endif // __linux__
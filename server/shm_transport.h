@@ -0,0 +1,38 @@
+// shm_transport.h
+#ifndef SHM_TRANSPORT_H
+#define SHM_TRANSPORT_H
+
+#include <cstdint>
+
+/*
+  Shared-memory transport for co-located clients. A client connects to the
+  transport's Unix socket and receives, with SCM_RIGHTS, a memfd holding a
+  request ring and a response ring (see shm_ring.h) plus one eventfd per
+  ring. From then on requests and responses are binary protocol messages
+  (see binary_protocol.h, without the u32 frame length) exchanged through
+  the rings; the socket only signals that the client went away.
+*/
+
+// Handshake message sent along with the descriptors
+struct ShmHello
+{
+    char magic[4]; // "RSHM"
+    uint32_t capacity;
+};
+
+// Descriptor order in the handshake
+enum ShmHelloFd
+{
+    SHM_FD_MEMORY = 0,
+    SHM_FD_REQUEST_EVENT = 1,  // client -> server wakeups
+    SHM_FD_RESPONSE_EVENT = 2, // server -> client wakeups
+    SHM_FD_COUNT = 3,
+};
+
+// Check whether memfd/eventfd are available on this platform
+bool shm_supported();
+
+// Accept shared-memory clients on a Unix listener, one thread each; does not return
+void shm_accept_loop(int server_fd);
+
+#endif // SHM_TRANSPORT_H
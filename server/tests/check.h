@@ -0,0 +1,58 @@
+// tests/check.h
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <iostream>
+
+// Minimal checks for the test executables: a failed CHECK is reported with
+// its location and the test carries on; main returns check_result() so
+// ctest sees the failure.
+
+inline int &check_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition)                                                                        \
+    do                                                                                          \
+    {                                                                                           \
+        if (!(condition))                                                                       \
+        {                                                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n";     \
+            check_failures()++;                                                                 \
+        }                                                                                       \
+    } while (0)
+
+// Passes when the statement throws an exception of the given type
+#define CHECK_THROWS(statement, type)                                                           \
+    do                                                                                          \
+    {                                                                                           \
+        bool thrown = false;                                                                    \
+        try                                                                                     \
+        {                                                                                       \
+            statement;                                                                          \
+        }                                                                                       \
+        catch (const type &)                                                                    \
+        {                                                                                       \
+            thrown = true;                                                                      \
+        }                                                                                       \
+        catch (...)                                                                             \
+        {                                                                                       \
+        }                                                                                       \
+        if (!thrown)                                                                            \
+        {                                                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " #statement " did not throw " #type "\n"; \
+            check_failures()++;                                                                 \
+        }                                                                                       \
+    } while (0)
+
+inline int check_result()
+{
+    if (check_failures() == 0)
+        return 0;
+    std::cerr << check_failures() << " check(s) failed\n";
+    return 1;
+}
+
+#endif // TESTS_CHECK_H
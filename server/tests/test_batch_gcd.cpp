@@ -0,0 +1,104 @@
+// tests/test_batch_gcd.cpp
+// Batch GCD: on crafted sets of moduli the product and remainder trees flag
+// exactly the moduli a pairwise comparison flags, for group sizes small
+// enough to split the tree everywhere and for one or several threads.
+#include "../batch_gcd.h"
+#include "check.h"
+
+#include <cstddef>
+#include <vector>
+
+// Checks one result against gcd(n_i, n_j) over every pair
+static bool MatchesPairwise(const std::vector<mpz_class> &moduli, const std::vector<SharedFactor> &found)
+{
+    size_t next = 0;
+    for (size_t i = 0; i < moduli.size(); i++)
+    {
+        const mpz_class &n = moduli[i];
+        mpz_class shared = 1;
+        bool splits = false;
+        for (size_t j = 0; j < moduli.size(); j++)
+        {
+            if (j == i)
+                continue;
+            mpz_class g;
+            mpz_gcd(g.get_mpz_t(), n.get_mpz_t(), moduli[j].get_mpz_t());
+            shared = lcm(shared, g);
+            splits = splits || (g != 1 && g != n);
+        }
+        if (shared == 1)
+            continue;
+        if (next == found.size() || found[next].index != i)
+            return false;
+        const mpz_class &factor = found[next++].factor;
+        // A partial share is reported as is; a modulus shared whole is split
+        // by some partner unless every partner is a copy of it
+        if (shared != n && factor != shared)
+            return false;
+        if (shared == n && (splits ? factor == n || n % factor != 0 || factor == 1 : factor != n))
+            return false;
+    }
+    return next == found.size();
+}
+
+int main()
+{
+    gmp_randclass random(gmp_randinit_default);
+    random.seed(7);
+    std::vector<mpz_class> primes(40);
+    for (mpz_class &p : primes)
+        mpz_nextprime(p.get_mpz_t(), mpz_class(random.get_z_bits(64) | (mpz_class(1) << 63)).get_mpz_t());
+
+    // Coprime moduli from disjoint prime pairs
+    std::vector<mpz_class> coprime;
+    for (size_t i = 0; i + 1 < 24; i += 2)
+        coprime.push_back(primes[i] * primes[i + 1]);
+
+    // One pair sharing a prime
+    std::vector<mpz_class> pair = coprime;
+    pair[3] = primes[30] * primes[31];
+    pair[8] = primes[30] * primes[32];
+
+    // A modulus sharing both its primes with different moduli comes out of
+    // the tree whole and has to be split against its partners
+    std::vector<mpz_class> doubly = coprime;
+    doubly[1] = primes[30] * primes[31];
+    doubly[5] = primes[30] * primes[32];
+    doubly[10] = primes[31] * primes[33];
+
+    // Exact duplicates stay whole; a duplicate with a third partner is split
+    std::vector<mpz_class> duplicates = coprime;
+    duplicates[2] = duplicates[7] = primes[34] * primes[35];
+    duplicates[4] = duplicates[9] = primes[36] * primes[37];
+    duplicates[11] = primes[36] * primes[38];
+
+    std::vector<std::vector<mpz_class>> sets = {coprime, pair, doubly, duplicates};
+    for (const std::vector<mpz_class> &moduli : sets)
+    {
+        for (size_t groupSize : {size_t(1), size_t(2), size_t(3), size_t(5), size_t(65536)})
+        {
+            for (unsigned threads : {1u, 4u})
+            {
+                BatchGcdOptions options;
+                options.threads = threads;
+                options.groupSize = groupSize;
+                CHECK(MatchesPairwise(moduli, BatchGcd(moduli, options)));
+            }
+        }
+    }
+
+    CHECK(BatchGcd(coprime).empty());
+    std::vector<SharedFactor> found = BatchGcd(pair);
+    CHECK(found.size() == 2 && found[0].index == 3 && found[0].factor == primes[30] && found[1].index == 8);
+    found = BatchGcd(doubly);
+    CHECK(found.size() == 3 && found[0].index == 1 && found[0].factor != doubly[1]);
+
+    // Degenerate inputs
+    CHECK(BatchGcd(std::vector<mpz_class>()).empty());
+    CHECK(BatchGcd(std::vector<mpz_class>{primes[0] * primes[1]}).empty());
+    std::vector<mpz_class> twins = {primes[0] * primes[1], primes[0] * primes[1]};
+    found = BatchGcd(twins);
+    CHECK(found.size() == 2 && found[0].factor == twins[0] && found[1].factor == twins[1]);
+
+    return check_result();
+}
@@ -0,0 +1,181 @@
+// tests/test_key_store.cpp
+// Key store persistence: reopening finds every key, the index is rebuilt
+// when missing, a second writer is locked out, read-only stores see the
+// committed records, and damaged files are refused instead of faulting.
+#include "../key_store.h"
+#include "check.h"
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static std::vector<char> ReadFile(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void WriteFile(const std::string &path, const std::vector<char> &bytes)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+int main()
+{
+    char dir[] = "/tmp/key_store_test.XXXXXX";
+    if (!mkdtemp(dir))
+        return 1;
+    std::string path = std::string(dir) + "/keys";
+
+    // A few keys stored many times take the index past its initial capacity
+    std::vector<PublicKey> pubs(3);
+    std::vector<PrivateKey> privs(3);
+    for (size_t i = 0; i < pubs.size(); i++)
+        CreateRSAKey(512, false, false, pubs[i], privs[i]);
+
+    const size_t stored = 3000;
+    std::vector<uint64_t> ids;
+    {
+        KeyStore store(path);
+        CHECK(store.Count() == 0);
+        for (size_t i = 0; i < stored; i++)
+            ids.push_back(store.Append(pubs[i % 3], privs[i % 3]));
+        CHECK(store.Count() == stored);
+
+        // One writer per store, even within a process
+        CHECK_THROWS(KeyStore second(path), std::runtime_error);
+    }
+
+    auto check_contents = [&](const KeyStore &store)
+    {
+        CHECK(store.Count() == stored);
+        for (size_t i = 0; i < stored; i += 97)
+        {
+            PublicKey pub;
+            PrivateKey priv;
+            CHECK(store.Find(ids[i], &pub, &priv));
+            CHECK(pub.nn == pubs[i % 3].nn && priv.dd == privs[i % 3].dd && priv.qinv == privs[i % 3].qinv);
+        }
+        CHECK(!store.Find(0, nullptr, nullptr));
+        size_t seen = 0;
+        bool ordered = true;
+        store.ForEach([&](uint64_t id, const PublicKey &pub)
+                      {
+            ordered = ordered && seen < stored && id == ids[seen] && pub.nn == pubs[seen % 3].nn;
+            seen++; });
+        CHECK(ordered && seen == stored);
+    };
+
+    // Reopen with the index, then without it
+    {
+        KeyStore store(path);
+        check_contents(store);
+    }
+    unlink((path + ".idx").c_str());
+    {
+        KeyStore store(path);
+        check_contents(store);
+        // A read-only store opens next to the writer and sees its records
+        KeyStore reader(path, true);
+        check_contents(reader);
+        CHECK_THROWS(reader.Append(pubs[0], privs[0]), std::runtime_error);
+    }
+    {
+        KeyStore store(path);
+        uint64_t id = store.Append(pubs[1], privs[1]);
+        CHECK(store.Count() == stored + 1);
+        CHECK(store.Find(id, nullptr, nullptr));
+        ids.push_back(id);
+    }
+
+    // Damaged copies are refused with an exception
+    std::vector<char> bytes = ReadFile(path);
+    uint64_t end;
+    memcpy(&end, bytes.data() + offsetof(KeyStoreHeader, end), sizeof(end));
+    std::string damaged = std::string(dir) + "/damaged";
+
+    WriteFile(damaged, std::vector<char>(bytes.begin(), bytes.begin() + end - 100));
+    CHECK_THROWS(KeyStore store(damaged), std::runtime_error);
+    CHECK_THROWS(KeyStore store(damaged, true), std::runtime_error);
+    unlink((damaged + ".idx").c_str());
+
+    std::vector<char> corrupt = bytes;
+    uint32_t huge = 1u << 30;
+    memcpy(corrupt.data() + sizeof(KeyStoreHeader) + offsetof(KeyRecordHeader, pubSize), &huge, sizeof(huge));
+    WriteFile(damaged, corrupt);
+    CHECK_THROWS(KeyStore store(damaged), std::runtime_error);
+    CHECK_THROWS(KeyStore(damaged, true).Count(), std::runtime_error);
+    unlink((damaged + ".idx").c_str());
+
+    // An index slot pointing at another record is caught by the id check
+    std::vector<char> misdirected = ReadFile(path + ".idx");
+    KeyIndexSlot *slots = reinterpret_cast<KeyIndexSlot *>(misdirected.data() + sizeof(KeyIndexHeader));
+    size_t slotCount = (misdirected.size() - sizeof(KeyIndexHeader)) / sizeof(KeyIndexSlot);
+    size_t first = slotCount, second = slotCount;
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        if (slots[i].id == ids[0])
+            first = i;
+        if (slots[i].id == ids[1])
+            second = i;
+    }
+    CHECK(first < slotCount && second < slotCount);
+    slots[first].offset = slots[second].offset;
+    WriteFile(damaged, bytes);
+    WriteFile(damaged + ".idx", misdirected);
+    {
+        KeyStore store(damaged);
+        CHECK(store.Find(ids[1], nullptr, nullptr));
+        CHECK_THROWS(store.Find(ids[0], nullptr, nullptr), std::runtime_error);
+    }
+    unlink((damaged + ".idx").c_str());
+
+    // A table with no free slot is rebuilt, whether its count disagrees with
+    // the slots or admits to a full table, instead of probing forever
+    std::vector<char> full = ReadFile(path + ".idx");
+    KeyIndexHeader *fullHeader = reinterpret_cast<KeyIndexHeader *>(full.data());
+    KeyIndexSlot *fullSlots = reinterpret_cast<KeyIndexSlot *>(full.data() + sizeof(KeyIndexHeader));
+    for (uint64_t i = 0; i < fullHeader->capacity; i++)
+    {
+        if (fullSlots[i].id == 0)
+            fullSlots[i] = KeyIndexSlot{i + 1, sizeof(KeyStoreHeader)};
+    }
+    for (uint64_t count : {uint64_t(fullHeader->count), uint64_t(fullHeader->capacity)})
+    {
+        fullHeader->count = count;
+        WriteFile(damaged, bytes);
+        WriteFile(damaged + ".idx", full);
+        KeyStore store(damaged);
+        CHECK(store.Count() == stored + 1);
+        CHECK(!store.Find(12345, nullptr, nullptr));
+        CHECK(store.Find(ids[stored], nullptr, nullptr));
+        uint64_t id = store.Append(pubs[2], privs[2]);
+        CHECK(store.Find(id, nullptr, nullptr) && store.Count() == stored + 2);
+    }
+    unlink((damaged + ".idx").c_str());
+
+    std::vector<char> foreign = bytes;
+    foreign[0] = 'X';
+    WriteFile(damaged, foreign);
+    CHECK_THROWS(KeyStore store(damaged), std::runtime_error);
+
+    // A failed open leaves the store unlocked for the next writer
+    WriteFile(damaged, bytes);
+    {
+        KeyStore store(damaged);
+        CHECK(store.Count() == stored + 1);
+    }
+
+    unlink(damaged.c_str());
+    unlink((damaged + ".idx").c_str());
+    unlink(path.c_str());
+    unlink((path + ".idx").c_str());
+    rmdir(dir);
+    return check_result();
+}
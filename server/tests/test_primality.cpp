@@ -0,0 +1,83 @@
+// tests/test_primality.cpp
+// Baillie-PSW: with no extra Miller-Rabin rounds behind it, IsPrime agrees
+// with mpz_probab_prime_p on every small number, on random and structured
+// large ones, and on the pseudoprimes that fool either half of the test alone.
+#include "../rsa_lib.h"
+#include "check.h"
+
+#include <gmp.h>
+
+static bool GmpPrime(const mpz_class &n)
+{
+    return mpz_probab_prime_p(n.get_mpz_t(), 50) != 0;
+}
+
+static bool Agrees(const mpz_class &n)
+{
+    return IsPrime(n) == GmpPrime(n);
+}
+
+int main()
+{
+    PrimalityPolicy policy;
+    policy.method = PrimalityPolicy::BailliePSW;
+    policy.extraRounds = 0;
+    SetPrimalityPolicy(policy);
+
+    // Every small number, including 0, 1, 2 and the trial-division primes
+    bool smallAgree = true;
+    for (unsigned long n = 0; n < 100000; n++)
+        smallAgree = smallAgree && Agrees(mpz_class(n));
+    CHECK(smallAgree);
+
+    // Strong pseudoprimes to base 2, Wieferich squares among them
+    for (const char *n : {"2047", "3277", "4033", "4681", "8321", "15841", "29341", "1194649", "12327121",
+                          "3215031751", "2152302898747", "3474749660383", "341550071728321",
+                          "3825123056546413051", "318665857834031151167461"})
+        CHECK(!IsPrime(mpz_class(n)));
+    // Strong Lucas pseudoprimes with Selfridge's parameters
+    for (const char *n : {"5459", "5777", "10877", "16109", "18971", "22499", "24569", "25199", "40309", "58519"})
+        CHECK(!IsPrime(mpz_class(n)));
+    // Carmichael numbers
+    for (const char *n : {"561", "1105", "1729", "2465", "2821", "6601", "8911", "41041", "825265", "321197185",
+                          "5394826801", "232250619601", "9746347772161"})
+        CHECK(!IsPrime(mpz_class(n)));
+
+    // Random numbers, primes, products of two primes and prime squares
+    gmp_randclass random(gmp_randinit_default);
+    random.seed(2024);
+    bool randomAgree = true, primesFound = true, productsRejected = true;
+    for (int i = 0; i < 2000; i++)
+    {
+        unsigned long bits = 64 + i % 449;
+        mpz_class n = random.get_z_bits(bits) | 1;
+        randomAgree = randomAgree && Agrees(n);
+
+        mpz_class p, q;
+        mpz_nextprime(p.get_mpz_t(), mpz_class(random.get_z_bits(bits / 2)).get_mpz_t());
+        mpz_nextprime(q.get_mpz_t(), mpz_class(random.get_z_bits(bits / 2)).get_mpz_t());
+        primesFound = primesFound && IsPrime(p) && IsPrime(q);
+        productsRejected = productsRejected && !IsPrime(p * q) && !IsPrime(p * p);
+    }
+    CHECK(randomAgree);
+    CHECK(primesFound);
+    CHECK(productsRejected);
+
+    // Known primes on both sides of the trial-division bound
+    CHECK(IsPrime(mpz_class("18446744073709551557")));                // largest below 2^64
+    CHECK(IsPrime(mpz_class("170141183460469231731687303715884105727"))); // 2^127 - 1
+    CHECK(!IsPrime(mpz_class("340282366920938463463374607431768211457"))); // 2^128 + 1
+
+    // The Gmp method and the default extra rounds give the same verdicts
+    policy.extraRounds = -1;
+    SetPrimalityPolicy(policy);
+    CHECK(!IsPrime(mpz_class("3825123056546413051")) && IsPrime(mpz_class("18446744073709551557")));
+    policy.method = PrimalityPolicy::Gmp;
+    SetPrimalityPolicy(policy);
+    bool gmpAgree = true;
+    for (unsigned long n = 0; n < 5000; n++)
+        gmpAgree = gmpAgree && Agrees(mpz_class(n));
+    CHECK(gmpAgree);
+
+    return check_result();
+}
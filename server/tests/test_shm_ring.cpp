@@ -0,0 +1,188 @@
+// tests/test_shm_ring.cpp
+// Shared memory ring: messages of every size survive many trips around a
+// small ring, a full ring refuses pushes until the consumer catches up,
+// corrupt counters are detected, a producer and consumer thread agree, and
+// a peer cannot resize a segment it was handed.
+#include "../shm_ring.h"
+#include "check.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+static const uint32_t CAPACITY = 256;
+
+// Message number `n` with `size` bytes of a pattern derived from both
+static std::string Message(size_t n, size_t size)
+{
+    std::string message(size, '\0');
+    for (size_t i = 0; i < size; i++)
+        message[i] = static_cast<char>(n * 31 + i);
+    return message;
+}
+
+static bool Push(ShmRing &ring, const std::string &message)
+{
+    iovec iov = {const_cast<char *>(message.data()), message.size()};
+    return ring.TryPush(&iov, 1);
+}
+
+#ifdef __linux__
+// Pass a descriptor through a Unix socket as the transport does; returns the
+// peer's copy
+static int PassDescriptor(int fd)
+{
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+        return -1;
+    char byte = 0;
+    iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    int received = -1;
+    if (sendmsg(pair[0], &msg, 0) == 1 && recvmsg(pair[1], &msg, 0) == 1)
+        memcpy(&received, CMSG_DATA(CMSG_FIRSTHDR(&msg)), sizeof(int));
+    close(pair[0]);
+    close(pair[1]);
+    return received;
+}
+
+// A client's copy of the segment cannot shrink or grow it under the server
+static void CheckSealedSegment()
+{
+    int fd = shm_create_segment(CAPACITY);
+    CHECK(fd >= 0);
+    size_t size = shm_segment_size(CAPACITY);
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    CHECK(base != MAP_FAILED);
+    shm_init_segment(base, CAPACITY);
+
+    int client = PassDescriptor(fd);
+    CHECK(client >= 0);
+    CHECK(ftruncate(client, 0) != 0 && errno == EPERM);
+    CHECK(ftruncate(client, size / 2) != 0 && errno == EPERM);
+    CHECK(ftruncate(client, size * 2) != 0 && errno == EPERM);
+    CHECK(fcntl(client, F_ADD_SEALS, F_SEAL_WRITE) != 0 && errno == EPERM);
+    CHECK(lseek(client, 0, SEEK_END) == static_cast<off_t>(size));
+
+    // The server's mapping still reaches the last byte
+    ShmRing producer = shm_response_ring(base, CAPACITY);
+    ShmRing consumer = shm_response_ring(base, CAPACITY);
+    std::string popped;
+    for (size_t n = 0; n < 10; n++)
+        CHECK(Push(producer, Message(n, producer.MaxMessage())) && consumer.TryPop(popped));
+
+    munmap(base, size);
+    close(client);
+    close(fd);
+}
+#endif
+
+int main()
+{
+    size_t segment = (shm_segment_size(CAPACITY) + 4095) & ~size_t(4095);
+    void *base = aligned_alloc(4096, segment);
+    shm_init_segment(base, CAPACITY);
+    ShmRing producer = shm_request_ring(base, CAPACITY);
+    ShmRing consumer = shm_request_ring(base, CAPACITY);
+    const size_t max = producer.MaxMessage();
+
+    // Sizes cycling through every length wrap the ring at every offset
+    std::string popped;
+    CHECK(!consumer.TryPop(popped));
+    for (size_t n = 0; n < 20000; n++)
+    {
+        std::string message = Message(n, n % (max + 1));
+        CHECK(Push(producer, message));
+        CHECK(consumer.TryPop(popped) && popped == message);
+    }
+    CHECK(!consumer.TryPop(popped));
+
+    // Fill until refused, then drain in order
+    size_t pushed = 0;
+    while (Push(producer, Message(pushed, 1 + pushed * 7 % 40)))
+        pushed++;
+    CHECK(pushed > 0);
+    for (size_t n = 0; n < pushed; n++)
+        CHECK(consumer.TryPop(popped) && popped == Message(n, 1 + n * 7 % 40));
+    CHECK(!consumer.TryPop(popped));
+
+    // Size limit, and a message gathered from several pieces
+    CHECK(Push(producer, Message(1, max)));
+    CHECK(consumer.TryPop(popped) && popped == Message(1, max));
+    CHECK(!Push(producer, Message(2, max + 1)));
+    std::string first = "gathered ", second = "from ", third = "pieces";
+    iovec pieces[3] = {{&first[0], first.size()}, {&second[0], second.size()}, {&third[0], third.size()}};
+    CHECK(producer.TryPush(pieces, 3));
+    const char *view;
+    size_t size;
+    CHECK(consumer.Peek(view, size) && std::string(view, size) == "gathered from pieces");
+    consumer.Release();
+
+    // Sleeping is refused while a message is waiting
+    CHECK(consumer.PrepareWait());
+    CHECK(producer.NeedsWake());
+    consumer.FinishWait();
+    CHECK(!producer.NeedsWake());
+    CHECK(Push(producer, "wake"));
+    CHECK(!consumer.PrepareWait());
+    CHECK(consumer.TryPop(popped) && popped == "wake");
+
+    // A peer scribbling over the counters is caught, not followed
+    ShmRingHeader *header = static_cast<ShmRingHeader *>(base);
+    header->tail.store(header->head.load() + CAPACITY + 8);
+    CHECK_THROWS(consumer.Peek(view, size), std::runtime_error);
+    header->tail.store(header->head.load() + 3);
+    CHECK_THROWS(consumer.Peek(view, size), std::runtime_error);
+
+    // One producer thread and one consumer thread
+    shm_init_segment(base, CAPACITY);
+    producer = shm_request_ring(base, CAPACITY);
+    consumer = shm_request_ring(base, CAPACITY);
+    const size_t messages = 100000;
+    std::thread writer([&producer, max]()
+                       {
+        for (size_t n = 0; n < messages; n++)
+        {
+            std::string message = Message(n, n % max + 1);
+            while (!Push(producer, message))
+                std::this_thread::yield();
+        } });
+    bool inOrder = true;
+    for (size_t n = 0; n < messages; n++)
+    {
+        while (!consumer.TryPop(popped))
+            std::this_thread::yield();
+        inOrder = inOrder && popped == Message(n, n % max + 1);
+    }
+    writer.join();
+    CHECK(inOrder);
+    CHECK(!consumer.TryPop(popped));
+
+    free(base);
+#ifdef __linux__
+    CheckSealedSegment();
+#endif
+    return check_result();
+}
@@ -0,0 +1,12 @@
+// timestamp.cpp
+#include "timestamp.h"
+
+#include <ctime>
+
+std::string current_timestamp()
+{
+    std::time_t now = std::time(nullptr);
+    char buf[100];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+    return std::string(buf);
+}
@@ -0,0 +1,11 @@
+// timestamp.h
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <string>
+
+// Get the current local time as "YYYY-MM-DD HH:MM:SS" for log lines; shared
+// by the server, the tracer in rsa_lib and the command line tools
+std::string current_timestamp();
+
+#endif // TIMESTAMP_H
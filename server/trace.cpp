@@ -0,0 +1,211 @@
+// trace.cpp
+#include "trace.h"
+#include "timestamp.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+// Events kept per thread; the oldest are dropped first
+static const size_t TRACE_EVENTS_PER_THREAD = 16384;
+
+static std::atomic<double> sample_rate{0};
+static std::atomic<uint64_t> slow_request_ns{0};
+
+// Sampled events finished on one thread, guarded by their own mutex so the
+// only contention is with an export
+struct ThreadTraceBuffer
+{
+    std::mutex mutex;
+    std::deque<TraceEvent> events;
+    std::deque<std::string> names; // request names, parallel to request events
+};
+
+static std::mutex buffers_mutex;
+static std::vector<std::shared_ptr<ThreadTraceBuffer>> buffers;
+
+// Registered on first use; outlives its thread so an export still sees it
+static ThreadTraceBuffer &thread_buffer()
+{
+    thread_local std::shared_ptr<ThreadTraceBuffer> buffer;
+    if (!buffer)
+    {
+        buffer = std::make_shared<ThreadTraceBuffer>();
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+// Small per-thread id for the trace viewer
+static uint32_t thread_id()
+{
+    static std::atomic<uint32_t> next{1};
+    thread_local uint32_t id = next++;
+    return id;
+}
+
+thread_local RequestTrace *current_trace = nullptr;
+
+uint64_t trace_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace_configure(double sampleRate, int slowRequestMs)
+{
+    sample_rate = std::min(1.0, std::max(0.0, sampleRate));
+    slow_request_ns = slowRequestMs > 0 ? static_cast<uint64_t>(slowRequestMs) * 1000000 : 0;
+}
+
+RequestTrace::RequestTrace() : start(0), tid(thread_id())
+{
+    double rate = sample_rate.load(std::memory_order_relaxed);
+    if (rate >= 1)
+    {
+        sampled = true;
+    }
+    else if (rate > 0)
+    {
+        thread_local std::minstd_rand generator(std::random_device{}());
+        sampled = std::uniform_real_distribution<double>(0, 1)(generator) < rate;
+    }
+    recording = sampled || slow_request_ns.load(std::memory_order_relaxed) != 0;
+    if (recording)
+        start = trace_now();
+}
+
+void RequestTrace::Add(const char *stage, uint64_t stageStart, uint64_t duration)
+{
+    if (recording)
+        events.push_back(TraceEvent{stage, stageStart, duration, thread_id()});
+}
+
+void RequestTrace::StageEnd(const char *stage, uint64_t stageStart)
+{
+    if (recording)
+        Add(stage, stageStart, trace_now() - stageStart);
+}
+
+void RequestTrace::Finish(const std::string &peer)
+{
+    if (!recording)
+        return;
+    uint64_t total = trace_now() - start;
+
+    uint64_t slow = slow_request_ns.load(std::memory_order_relaxed);
+    if (slow != 0 && total >= slow)
+    {
+        // Sum repeated stages (batch items, retries) into one figure each
+        std::map<std::string, uint64_t> stages;
+        for (const TraceEvent &event : events)
+            stages[event.name] += event.duration;
+        std::ostringstream breakdown;
+        breakdown << std::fixed;
+        breakdown.precision(3);
+        for (const auto &stage : stages)
+            breakdown << (breakdown.tellp() > 0 ? ", " : "") << stage.first << " " << stage.second / 1e6 << " ms";
+        char elapsed[32];
+        snprintf(elapsed, sizeof(elapsed), "%.3f ms", total / 1e6);
+        std::cerr << "[" << current_timestamp() << "] Slow request " << name << " from " << peer << ": "
+                  << elapsed << " (" << breakdown.str() << ")\n";
+    }
+
+    if (!sampled)
+        return;
+    ThreadTraceBuffer &buffer = thread_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    // The request itself is stored first with a null name; its label goes to `names`
+    buffer.events.push_back(TraceEvent{nullptr, start, total, tid});
+    buffer.names.push_back(name + " " + peer);
+    buffer.events.insert(buffer.events.end(), events.begin(), events.end());
+    while (buffer.events.size() > TRACE_EVENTS_PER_THREAD)
+    {
+        if (buffer.events.front().name == nullptr)
+            buffer.names.pop_front();
+        buffer.events.pop_front();
+    }
+}
+
+TraceScope::TraceScope(RequestTrace *trace) : previous(current_trace)
+{
+    current_trace = trace;
+}
+
+TraceScope::~TraceScope()
+{
+    current_trace = previous;
+}
+
+TraceSpan::TraceSpan(const char *name) : trace(current_trace), name(name)
+{
+    if (trace && trace->Recording())
+        start = trace_now();
+    else
+        trace = nullptr;
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (trace)
+        trace->Add(name, start, trace_now() - start);
+}
+
+// Function to escape a request label for JSON
+static std::string escape_label(const std::string &text)
+{
+    std::string out;
+    for (char ch : text)
+    {
+        if (ch == '"' || ch == '\\')
+            out += '\\';
+        if (static_cast<unsigned char>(ch) >= 0x20)
+            out += ch;
+    }
+    return out;
+}
+
+std::string trace_export_chrome(bool clear)
+{
+    std::vector<std::shared_ptr<ThreadTraceBuffer>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        snapshot = buffers;
+    }
+
+    std::string json = "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    char line[256];
+    for (const auto &buffer : snapshot)
+    {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        size_t request = 0;
+        for (const TraceEvent &event : buffer->events)
+        {
+            json += first ? "\n" : ",\n";
+            first = false;
+            // Trace-event times are microseconds
+            snprintf(line, sizeof(line), "{ \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, ",
+                     event.tid, event.start / 1e3, event.duration / 1e3);
+            json += line;
+            if (event.name == nullptr)
+                json += "\"cat\": \"request\", \"name\": \"" + escape_label(buffer->names[request++]) + "\" }";
+            else
+                json += "\"cat\": \"stage\", \"name\": \"" + std::string(event.name) + "\" }";
+        }
+        if (clear)
+        {
+            buffer->events.clear();
+            buffer->names.clear();
+        }
+    }
+    json += "\n] }";
+    return json;
+}
@@ -0,0 +1,96 @@
+// trace.h
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-request stage tracing. Each request owns a RequestTrace; TraceSpan
+// scopes on the thread currently working for it (see TraceScope) record how
+// long each stage took. Sampled requests are buffered per thread and
+// exported as Chrome trace-event JSON (chrome://tracing, Perfetto); requests
+// slower than the slow-request threshold are logged with their stage
+// breakdown. When neither is enabled a span costs one thread-local load.
+
+// Current steady clock time in nanoseconds, for stages timed by hand
+uint64_t trace_now();
+
+// One recorded stage; times are nanoseconds on the steady clock
+struct TraceEvent
+{
+    const char *name; // static string
+    uint64_t start;
+    uint64_t duration;
+    uint32_t tid;
+};
+
+class RequestTrace
+{
+public:
+    // Decides whether this request is sampled
+    RequestTrace();
+
+    RequestTrace(const RequestTrace &) = delete;
+    RequestTrace &operator=(const RequestTrace &) = delete;
+
+    bool Recording() const { return recording; }
+    // Label the request once its path is known
+    void SetName(const std::string &requestName) { name = requestName; }
+    void Add(const char *stage, uint64_t start, uint64_t duration);
+
+    // Time a stage by hand, e.g. across a coroutine suspension
+    uint64_t StageStart() const { return recording ? trace_now() : 0; }
+    void StageEnd(const char *stage, uint64_t stageStart);
+
+    // Close the request: buffer it if sampled, log it if slow
+    void Finish(const std::string &peer);
+
+private:
+    std::string name = "request";
+    uint64_t start;
+    uint32_t tid;
+    bool sampled = false;
+    bool recording = false;
+    std::vector<TraceEvent> events;
+};
+
+// Makes a trace current on this thread for the lifetime of the scope. Never
+// keep one across a coroutine suspension: the thread moves on to other work.
+class TraceScope
+{
+public:
+    explicit TraceScope(RequestTrace *trace);
+    ~TraceScope();
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    RequestTrace *previous;
+};
+
+// Records the enclosing block as a stage of the current request, if any
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    RequestTrace *trace;
+    const char *name;
+    uint64_t start = 0;
+};
+
+// Sample a fraction (0 to 1) of requests and log requests slower than
+// slowRequestMs (0 disables the log)
+void trace_configure(double sampleRate, int slowRequestMs);
+
+// Buffered sampled requests as Chrome trace-event JSON; `clear` empties the buffers
+std::string trace_export_chrome(bool clear);
+
+#endif // TRACE_H
@@ -0,0 +1,572 @@
+// uring_backend.cpp
+#include "uring_backend.h"
+#include "http_server.h"
+#include "trace.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+static const unsigned RING_ENTRIES = 1024;
+static const unsigned REGISTERED_BUFFERS = 256;
+static const size_t REGISTERED_BUFFER_SIZE = 16384;
+
+// Operation kind lives in the top byte of the user data, connection index below it
+enum UringOp : uint64_t
+{
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_CLOSE,
+    OP_WAKE,
+};
+
+static uint64_t MakeUserData(UringOp op, uint64_t index)
+{
+    return (static_cast<uint64_t>(op) << 56) | index;
+}
+
+// Minimal io_uring wrapper over the raw system calls (no liburing dependency)
+class Ring
+{
+public:
+    explicit Ring(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+        {
+            throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(errno));
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap)
+        {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = Map(sqRingSize, IORING_OFF_SQ_RING);
+        cqRing = singleMmap ? sqRing : Map(cqRingSize, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(Map(sqesSize, IORING_OFF_SQES));
+
+        unsigned char *sq = static_cast<unsigned char *>(sqRing);
+        sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqEntries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        localTail = *sqTail;
+
+        unsigned char *cq = static_cast<unsigned char *>(cqRing);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    }
+
+    ~Ring()
+    {
+        munmap(sqes, sqesSize);
+        if (cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        munmap(sqRing, sqRingSize);
+        close(fd);
+    }
+
+    Ring(const Ring &) = delete;
+    Ring &operator=(const Ring &) = delete;
+
+    // Get a zeroed SQE; it is submitted with the next SubmitAndWait
+    io_uring_sqe *GetSqe()
+    {
+        if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+        {
+            SubmitAndWait(0);
+        }
+        unsigned index = localTail & sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        localTail++;
+        return sqe;
+    }
+
+    // Submit every queued SQE in one system call, waiting for waitNr completions
+    void SubmitAndWait(unsigned waitNr)
+    {
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        unsigned toSubmit = localTail - submitted;
+        while (true)
+        {
+            int ret = syscall(__NR_io_uring_enter, fd, toSubmit, waitNr, waitNr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (ret >= 0)
+            {
+                submitted += ret;
+                return;
+            }
+            if (errno != EINTR)
+            {
+                std::cerr << "[" << current_timestamp() << "] io_uring_enter failed: " << strerror(errno) << "\n";
+                return;
+            }
+        }
+    }
+
+    // Call fn for every available completion
+    template <typename Fn>
+    void ForEachCqe(Fn fn)
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            io_uring_cqe cqe = cqes[head & cqMask];
+            head++;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            fn(cqe);
+        }
+    }
+
+    bool RegisterBuffers(const iovec *iovecs, unsigned count)
+    {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs, count) == 0;
+    }
+
+private:
+    void *Map(size_t size, off_t offset)
+    {
+        void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if (addr == MAP_FAILED)
+        {
+            throw std::runtime_error(std::string("io_uring mmap failed: ") + strerror(errno));
+        }
+        return addr;
+    }
+
+    int fd;
+    void *sqRing;
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    io_uring_sqe *sqes;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned localTail;
+    unsigned submitted = 0;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+};
+
+struct UringConnection
+{
+    int fd = -1;
+    int buffer = -1;              // registered buffer index, or -1
+    std::vector<char> heapBuffer; // used when no registered buffer is free
+    std::string raw;
+    HttpRequest request;
+    size_t bodyOffset = std::string::npos;
+    size_t contentLength = 0;
+    HttpResponse response;
+    iovec iov[HTTP_RESPONSE_IOVECS];
+    iovec *pending = nullptr; // first iovec not fully sent
+    size_t pendingCount = 0;
+    msghdr msg;
+};
+
+class UringServer
+{
+public:
+    UringServer(int serverFd, int shard) : ring(RING_ENTRIES), serverFd(serverFd), shard(shard)
+    {
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+        if (wakeFd < 0)
+        {
+            throw std::runtime_error(std::string("eventfd failed: ") + strerror(errno));
+        }
+
+        // Register one slab per connection up to REGISTERED_BUFFERS; the kernel
+        // pins them once instead of mapping user memory on every read
+        bufferMemory.resize(REGISTERED_BUFFERS * REGISTERED_BUFFER_SIZE);
+        std::vector<iovec> iovecs(REGISTERED_BUFFERS);
+        for (unsigned i = 0; i < REGISTERED_BUFFERS; i++)
+        {
+            iovecs[i].iov_base = &bufferMemory[i * REGISTERED_BUFFER_SIZE];
+            iovecs[i].iov_len = REGISTERED_BUFFER_SIZE;
+            freeBuffers.push_back(REGISTERED_BUFFERS - 1 - i);
+        }
+        fixedBuffers = ring.RegisterBuffers(iovecs.data(), iovecs.size());
+        if (!fixedBuffers)
+        {
+            std::cerr << "[" << current_timestamp() << "] io_uring buffer registration failed (" << strerror(errno) << "), using plain recv\n";
+            freeBuffers.clear();
+        }
+    }
+
+    void Run()
+    {
+        QueueAccept();
+        QueueWake();
+        while (true)
+        {
+            ring.SubmitAndWait(1);
+            ring.ForEachCqe([this](const io_uring_cqe &cqe)
+                            { Complete(cqe); });
+        }
+    }
+
+private:
+    void QueueAccept()
+    {
+        io_uring_sqe *sqe = ring.GetSqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = serverFd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = MakeUserData(OP_ACCEPT, 0);
+    }
+
+    void QueueWake()
+    {
+        io_uring_sqe *sqe = ring.GetSqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = wakeFd;
+        sqe->addr = reinterpret_cast<uint64_t>(&wakeValue);
+        sqe->len = sizeof(wakeValue);
+        sqe->user_data = MakeUserData(OP_WAKE, 0);
+    }
+
+    void QueueRecv(size_t index)
+    {
+        UringConnection &conn = *connections[index];
+        io_uring_sqe *sqe = ring.GetSqe();
+        sqe->fd = conn.fd;
+        sqe->user_data = MakeUserData(OP_RECV, index);
+        if (conn.buffer >= 0)
+        {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->addr = reinterpret_cast<uint64_t>(&bufferMemory[conn.buffer * REGISTERED_BUFFER_SIZE]);
+            sqe->len = REGISTERED_BUFFER_SIZE;
+            sqe->buf_index = conn.buffer;
+        }
+        else
+        {
+            conn.heapBuffer.resize(REGISTERED_BUFFER_SIZE);
+            sqe->opcode = IORING_OP_RECV;
+            sqe->addr = reinterpret_cast<uint64_t>(conn.heapBuffer.data());
+            sqe->len = conn.heapBuffer.size();
+        }
+    }
+
+    // Send the response pieces with one SENDMSG, resubmitting the rest on a short write
+    void QueueSend(size_t index)
+    {
+        UringConnection &conn = *connections[index];
+        memset(&conn.msg, 0, sizeof(conn.msg));
+        conn.msg.msg_iov = conn.pending;
+        conn.msg.msg_iovlen = conn.pendingCount;
+
+        io_uring_sqe *sqe = ring.GetSqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = MakeUserData(OP_SEND, index);
+    }
+
+    void QueueClose(size_t index)
+    {
+        io_uring_sqe *sqe = ring.GetSqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = connections[index]->fd;
+        sqe->user_data = MakeUserData(OP_CLOSE, index);
+    }
+
+    void Complete(const io_uring_cqe &cqe)
+    {
+        UringOp op = static_cast<UringOp>(cqe.user_data >> 56);
+        size_t index = cqe.user_data & ((uint64_t(1) << 56) - 1);
+        switch (op)
+        {
+        case OP_ACCEPT:
+            if (cqe.res >= 0)
+            {
+                Accepted(cqe.res);
+            }
+            else
+            {
+                std::cerr << "[" << current_timestamp() << "] accept failed: " << strerror(-cqe.res) << "\n";
+            }
+            // Multishot accept stays armed until the kernel says otherwise
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+            {
+                QueueAccept();
+            }
+            break;
+        case OP_RECV:
+            Received(index, cqe.res);
+            break;
+        case OP_SEND:
+            Sent(index, cqe.res);
+            break;
+        case OP_CLOSE:
+            Release(index);
+            break;
+        case OP_WAKE:
+            DrainResponses();
+            QueueWake();
+            break;
+        }
+    }
+
+    void Accepted(int fd)
+    {
+        size_t index;
+        if (freeSlots.empty())
+        {
+            index = connections.size();
+            connections.emplace_back(new UringConnection());
+        }
+        else
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+
+        UringConnection &conn = *connections[index];
+        conn.fd = fd;
+        // The accept SQE carries no address, so ask the socket for it
+        sockaddr_storage client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        conn.request.peer = getpeername(fd, reinterpret_cast<sockaddr *>(&client_addr), &client_addr_len) == 0
+                                ? describe_peer(client_addr)
+                                : "unknown";
+        conn.request.fd = fd;
+        if (!freeBuffers.empty())
+        {
+            conn.buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+
+        shard_metrics[shard].accepted++;
+        shard_metrics[shard].active++;
+        QueueRecv(index);
+    }
+
+    void Received(size_t index, int res)
+    {
+        UringConnection &conn = *connections[index];
+        if (res <= 0)
+        {
+            QueueClose(index);
+            return;
+        }
+
+        const char *data = conn.buffer >= 0 ? &bufferMemory[conn.buffer * REGISTERED_BUFFER_SIZE] : conn.heapBuffer.data();
+        conn.raw.append(data, res);
+
+        if (conn.bodyOffset == std::string::npos)
+        {
+            conn.bodyOffset = parse_request_head(conn.raw, conn.request, conn.contentLength);
+            if (conn.bodyOffset != std::string::npos && conn.contentLength <= max_body_size)
+                conn.raw.reserve(conn.bodyOffset + conn.contentLength);
+        }
+        if (!request_within_limits(conn.request, conn.raw.size(), conn.bodyOffset, conn.contentLength))
+        {
+            // Answer with the rejection; the rest of the request is never read
+            conn.raw.clear();
+            conn.bodyOffset = 0;
+            conn.contentLength = 0;
+        }
+        else if (conn.bodyOffset == std::string::npos || conn.raw.size() < conn.bodyOffset + conn.contentLength)
+        {
+            QueueRecv(index);
+            return;
+        }
+
+        // Hand the complete request to the worker pool; the ring thread only does I/O
+        conn.request.body = conn.raw.substr(conn.bodyOffset, conn.contentLength);
+        HttpRequest request = std::move(conn.request);
+        compute_pool().Submit([this, index, request = std::move(request)]()
+                                 {
+            // Traced from the worker; the ring thread's recv and send are not covered
+            RequestTrace trace;
+            TraceScope scope(&trace);
+            trace.SetName(request.method + " " + request.path);
+            HttpResponse response;
+            {
+                TraceSpan span("process");
+                response = process_request(request);
+            }
+            // A streamed body is written from this worker; the ring then only closes
+            if (response.IsStreaming())
+            {
+                TraceSpan span("send");
+                if (!response.WriteTo(request.fd))
+                    std::cerr << "[" << current_timestamp() << "] Failed to stream response to " << request.peer << "\n";
+            }
+            trace.Finish(request.peer);
+            // A deferred response comes back later from whoever completes it
+            if (response.IsDeferred())
+                response.Resume([this, index](HttpResponse result)
+                                { Complete(index, std::move(result)); });
+            else
+                Complete(index, std::move(response)); });
+    }
+
+    // Queue a finished response for the ring thread; callable from any thread
+    void Complete(size_t index, HttpResponse response)
+    {
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            wake = done.empty();
+            done.emplace_back(index, std::move(response));
+        }
+        // One eventfd write covers every response queued before the ring drains
+        if (wake)
+        {
+            uint64_t one = 1;
+            if (write(wakeFd, &one, sizeof(one)) < 0)
+                std::cerr << "[" << current_timestamp() << "] eventfd write failed\n";
+        }
+    }
+
+    void DrainResponses()
+    {
+        std::vector<std::pair<size_t, HttpResponse>> ready;
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            ready.swap(done);
+        }
+        for (auto &item : ready)
+        {
+            UringConnection &conn = *connections[item.first];
+            if (item.second.IsStreaming())
+            {
+                QueueClose(item.first);
+                continue;
+            }
+            conn.response = std::move(item.second);
+            conn.pending = conn.iov;
+            conn.pendingCount = conn.response.ToIovec(conn.iov);
+            QueueSend(item.first);
+        }
+    }
+
+    void Sent(size_t index, int res)
+    {
+        UringConnection &conn = *connections[index];
+        if (res < 0)
+        {
+            QueueClose(index);
+            return;
+        }
+        conn.pendingCount = advance_iovec(conn.pending, conn.pendingCount, res);
+        if (conn.pendingCount > 0)
+        {
+            QueueSend(index);
+            return;
+        }
+        QueueClose(index);
+    }
+
+    void Release(size_t index)
+    {
+        UringConnection &conn = *connections[index];
+        if (conn.buffer >= 0)
+        {
+            freeBuffers.push_back(conn.buffer);
+        }
+        conn = UringConnection();
+        freeSlots.push_back(index);
+        shard_metrics[shard].active--;
+    }
+
+    Ring ring;
+    int serverFd;
+    int shard;
+    int wakeFd;
+    uint64_t wakeValue = 0;
+
+    std::vector<std::unique_ptr<UringConnection>> connections;
+    std::vector<size_t> freeSlots;
+
+    std::vector<char> bufferMemory;
+    std::vector<int> freeBuffers;
+    bool fixedBuffers = false;
+
+    // Responses finished by workers, waiting for the ring thread to send them
+    std::mutex doneMutex;
+    std::vector<std::pair<size_t, HttpResponse>> done;
+};
+
+// Check whether the io_uring backend is compiled in and the kernel allows it
+bool uring_supported()
+{
+    try
+    {
+        Ring probe(2);
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+// Run the io_uring event loop for one shard's listening socket
+void uring_loop(int server_fd, int shard)
+{
+    UringServer server(server_fd, shard);
+    server.Run();
+}
+
+#else // !HAVE_IO_URING
+
+#include <cstdlib>
+#include <iostream>
+
+bool uring_supported()
+{
+    return false;
+}
+
+void uring_loop(int, int)
+{
+    std::cerr << "io_uring backend is not available on this platform\n";
+    std::abort();
+}
+
+#endif // HAVE_IO_URING
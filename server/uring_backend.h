@@ -0,0 +1,14 @@
+// uring_backend.h
+#ifndef URING_BACKEND_H
+#define URING_BACKEND_H
+
+// Check whether the io_uring backend is compiled in and the kernel allows it
+bool uring_supported();
+
+// Run the io_uring event loop for one shard's listening socket: multishot
+// accept, reads into registered buffers, endpoint work on compute_pool(),
+// and all socket operations batched into one io_uring_enter per loop
+// iteration. Does not return.
+void uring_loop(int server_fd, int shard);
+
+#endif // URING_BACKEND_H